@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmpxx.h>
+
+#include <parallel_reduce.hpp>
+
+// Long running pi computations that can be interrupted and resumed.
+//
+// Series:
+//  - leibniz: pi = 4 (1 - 1/3 + 1/5 - ...), the series of pi_taylor, summed
+//    in long double. The argument is the number of steps.
+//  - machin: pi = 16 arctan(1/5) - 4 arctan(1/239)
+//  - chudnovsky: about 14 digits per term
+// For machin and chudnovsky the argument is the number of decimal digits.
+//
+// machin and chudnovsky are summed exactly with binary splitting. A series
+//   S = sum_k a(k) / b(k) * p(0)...p(k) / (q(0)...q(k))
+// restricted to [l, r) is kept as four integers P, Q, B, T with
+//   S(l, r) = T / (B Q) * (p(0)...p(l-1) / (q(0)...q(l-1)))
+// and two neighbouring ranges combine with
+//   P = Pl Pr, Q = Ql Qr, B = Bl Br, T = Br Qr Tl + Bl Pl Tr
+//
+// The terms are processed in rounds: every thread splits a block of
+// `block` terms on its own, the blocks of the round are combined in a
+// pairwise tree and the result is appended to the running state. Every
+// `interval` seconds the running state is written to the checkpoint file,
+// and a run started with an existing checkpoint continues from it.
+
+using my_float = long double;
+
+enum class series_kind { leibniz, machin, chudnovsky };
+
+struct split_state {
+    mpz_class P = 1, Q = 1, B = 1, T = 0;
+};
+
+split_state combine(const split_state &l, const split_state &r) {
+    split_state s;
+    s.P = l.P * r.P;
+    s.Q = l.Q * r.Q;
+    s.B = l.B * r.B;
+    s.T = r.B * r.Q * l.T + l.B * l.P * r.T;
+    return s;
+}
+
+// One series of a formula. For arctan(1/x), x is the argument; x == 0
+// selects the Chudnovsky series.
+struct component {
+    long coefficient;
+    unsigned long x;
+    size_t terms;
+    size_t next = 0;
+    split_state state;
+};
+
+split_state leaf(const component &c, size_t k) {
+    split_state s;
+    if (c.x == 0) {
+        // 640320^3 / 24
+        static const mpz_class C3_24("10939058860032000");
+        if (k > 0) {
+            mpz_class kk(static_cast<unsigned long>(k));
+            s.P = -(6 * kk - 5) * (2 * kk - 1) * (6 * kk - 1);
+            s.Q = kk * kk * kk * C3_24;
+        }
+        s.T = s.P * (13591409 + 545140134 * mpz_class(static_cast<unsigned long>(k)));
+    } else {
+        if (k == 0) {
+            s.Q = c.x;
+        } else {
+            s.P = -1;
+            s.Q = mpz_class(c.x) * c.x;
+        }
+        s.B = static_cast<unsigned long>(2 * k + 1);
+        s.T = s.P;
+    }
+    return s;
+}
+
+split_state split(const component &c, size_t l, size_t r) {
+    if (r - l == 1) {
+        return leaf(c, l);
+    }
+    size_t m = l + (r - l) / 2;
+    return combine(split(c, l, m), split(c, m, r));
+}
+
+// combines v[0] ... v[n - 1] in a fixed pairwise tree
+split_state combine_tree(std::vector<split_state> &v) {
+    for (size_t size = v.size(); size > 1; size = (size + 1) / 2) {
+        for (size_t i = 0; i < size / 2; ++i) {
+            v[i] = combine(v[2 * i], v[2 * i + 1]);
+        }
+        if (size % 2) {
+            v[size / 2] = v[size - 1];
+        }
+    }
+    return v[0];
+}
+
+// Leibniz: compensated running sum of the block sums
+struct leibniz_state {
+    size_t steps;
+    size_t next = 0;
+    my_float sum = 0, compensation = 0;
+};
+
+my_float leibniz_block(size_t begin, size_t end) {
+    my_float sum = 0.0f;
+    int sign = begin & 0x1 ? -1 : 1;
+    for (size_t n = begin; n < end; n++) {
+        sum += sign / static_cast<my_float>(2 * n + 1);
+        sign = -sign;
+    }
+    return sum;
+}
+
+void leibniz_add(leibniz_state &s, my_float value) {
+    my_float t = s.sum + value;
+    if (std::fabs(s.sum) >= std::fabs(value)) {
+        s.compensation += (s.sum - t) + value;
+    } else {
+        s.compensation += (value - t) + s.sum;
+    }
+    s.sum = t;
+}
+
+struct options {
+    series_kind kind = series_kind::chudnovsky;
+    size_t n = 0;               // digits, or steps for leibniz
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t block = 0;           // terms per thread and round, 0 picks a default
+    std::string checkpoint;
+    double interval = 60;       // seconds between checkpoints
+    std::string output;
+};
+
+std::string kind_name(series_kind kind) {
+    switch (kind) {
+        case series_kind::leibniz: return "leibniz";
+        case series_kind::machin: return "machin";
+        default: return "chudnovsky";
+    }
+}
+
+options usage(int argc, const char *argv[]) {
+    const char *syntax = "Invalid syntax: pi_series <leibniz|machin|chudnovsky> <steps|digits> "
+        "[--threads=<n>] [--block=<terms>] [--checkpoint=<file>] [--interval=<seconds>] "
+        "[--output=<file>]";
+    if (argc < 3) {
+        std::cerr << syntax << std::endl;
+        exit(1);
+    }
+    options opt;
+    std::string kind = argv[1];
+    if (kind == "leibniz") {
+        opt.kind = series_kind::leibniz;
+    } else if (kind == "machin") {
+        opt.kind = series_kind::machin;
+    } else if (kind == "chudnovsky") {
+        opt.kind = series_kind::chudnovsky;
+    } else {
+        std::cerr << syntax << std::endl;
+        exit(1);
+    }
+    opt.n = std::stoll(argv[2]);
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--threads=") == 0) {
+            opt.threads = std::stoll(arg.substr(10));
+        } else if (arg.compare(0, 8, "--block=") == 0) {
+            opt.block = std::stoll(arg.substr(8));
+        } else if (arg.compare(0, 13, "--checkpoint=") == 0) {
+            opt.checkpoint = arg.substr(13);
+        } else if (arg.compare(0, 11, "--interval=") == 0) {
+            opt.interval = std::stod(arg.substr(11));
+        } else if (arg.compare(0, 9, "--output=") == 0) {
+            opt.output = arg.substr(9);
+        } else {
+            std::cerr << syntax << std::endl;
+            exit(1);
+        }
+    }
+    if (opt.n == 0 || opt.threads == 0) {
+        std::cerr << "The number of steps or digits and of threads must be positive" << std::endl;
+        exit(1);
+    }
+    if (opt.block == 0) {
+        opt.block = opt.kind == series_kind::leibniz ? 1 << 24 : 1 << 10;
+    }
+    return opt;
+}
+
+std::vector<component> make_components(const options &opt) {
+    // terms so that the truncation error is below 10^-digits
+    const double digits = opt.n + 10;
+    std::vector<component> components;
+    if (opt.kind == series_kind::leibniz) {
+        return components;
+    } else if (opt.kind == series_kind::machin) {
+        for (auto cx : {std::make_pair(16L, 5UL), std::make_pair(-4L, 239UL)}) {
+            component c;
+            c.coefficient = cx.first;
+            c.x = cx.second;
+            c.terms = static_cast<size_t>(digits / (2 * std::log10(double(cx.second)))) + 1;
+            components.push_back(c);
+        }
+    } else {
+        component c;
+        c.coefficient = 1;
+        c.x = 0;
+        c.terms = static_cast<size_t>(digits / 14.1816474627) + 1;
+        components.push_back(c);
+    }
+    return components;
+}
+
+// Checkpoint file: a header identifying the run, then the state of every
+// component. Integers are written in hex and long doubles as hex floats,
+// both exact.
+std::string header(const options &opt) {
+    std::ostringstream ss;
+    ss << "pi_series 1 " << kind_name(opt.kind) << " " << opt.n;
+    return ss.str();
+}
+
+void write_checkpoint(const options &opt, const std::vector<component> &components,
+        const leibniz_state &leibniz) {
+    // write aside and rename, so an interruption never leaves a torn file
+    const std::string tmp = opt.checkpoint + ".tmp";
+    {
+        std::ofstream ofile(tmp, std::ios::out | std::ios::trunc);
+        ofile << header(opt) << "\n";
+        if (opt.kind == series_kind::leibniz) {
+            char sum[64], compensation[64];
+            snprintf(sum, sizeof(sum), "%La", leibniz.sum);
+            snprintf(compensation, sizeof(compensation), "%La", leibniz.compensation);
+            ofile << leibniz.next << " " << sum << " " << compensation << "\n";
+        } else {
+            for (const auto &c : components) {
+                ofile << c.next << " " << c.state.P.get_str(16) << " " << c.state.Q.get_str(16)
+                    << " " << c.state.B.get_str(16) << " " << c.state.T.get_str(16) << "\n";
+            }
+        }
+        if (!ofile) {
+            std::cerr << "Cannot write checkpoint " << tmp << std::endl;
+            exit(1);
+        }
+    }
+    if (std::rename(tmp.c_str(), opt.checkpoint.c_str()) != 0) {
+        std::cerr << "Cannot write checkpoint " << opt.checkpoint << std::endl;
+        exit(1);
+    }
+}
+
+// returns false when there is no checkpoint to resume from
+bool read_checkpoint(const options &opt, std::vector<component> &components,
+        leibniz_state &leibniz) {
+    std::ifstream ifile(opt.checkpoint);
+    if (!ifile) {
+        return false;
+    }
+    std::string line;
+    std::getline(ifile, line);
+    if (line != header(opt)) {
+        std::cerr << "Checkpoint " << opt.checkpoint << " belongs to another run: " << line << std::endl;
+        exit(1);
+    }
+    if (opt.kind == series_kind::leibniz) {
+        std::string sum, compensation;
+        ifile >> leibniz.next >> sum >> compensation;
+        leibniz.sum = std::strtold(sum.c_str(), nullptr);
+        leibniz.compensation = std::strtold(compensation.c_str(), nullptr);
+    } else {
+        for (auto &c : components) {
+            std::string P, Q, B, T;
+            ifile >> c.next >> P >> Q >> B >> T;
+            if (ifile) {
+                c.state.P.set_str(P, 16);
+                c.state.Q.set_str(Q, 16);
+                c.state.B.set_str(B, 16);
+                c.state.T.set_str(T, 16);
+            }
+        }
+    }
+    if (!ifile) {
+        std::cerr << "Corrupted checkpoint " << opt.checkpoint << std::endl;
+        exit(1);
+    }
+    return true;
+}
+
+// decimal expansion of pi from the finished components
+std::string finish(const options &opt, const std::vector<component> &components) {
+    const mp_bitcnt_t bits = static_cast<mp_bitcnt_t>((opt.n + 20) * 3.3219280948873623) + 64;
+    mpf_class pi(0, bits);
+    if (opt.kind == series_kind::machin) {
+        for (const auto &c : components) {
+            mpf_class term(c.state.T, bits);
+            term /= mpf_class(c.state.B * c.state.Q, bits);
+            pi += c.coefficient * term;
+        }
+    } else {
+        const auto &s = components[0].state;
+        mpf_class root(10005, bits);
+        root = sqrt(root);
+        pi = 426880 * root * mpf_class(s.B * s.Q, bits) / mpf_class(s.T, bits);
+    }
+    // get_str rounds its last digit: ask for guard digits beyond the
+    // requested ones (the series and the precision cover n + 10) and cut
+    // them, so the printed digits are the leading digits of pi
+    const size_t guard = 10;
+    mp_exp_t exponent;
+    std::string digits = pi.get_str(exponent, 10, opt.n + 1 + guard);
+    digits.resize(opt.n + 1 + guard, '0');
+    digits.resize(opt.n + 1);
+    return digits.substr(0, 1) + "." + digits.substr(1);
+}
+
+int main(int argc, const char *argv[]) {
+
+    auto opt = usage(argc, argv);
+    auto components = make_components(opt);
+    leibniz_state leibniz;
+    leibniz.steps = opt.n;
+
+    if (!opt.checkpoint.empty() && read_checkpoint(opt, components, leibniz)) {
+        std::cerr << "Resuming from " << opt.checkpoint << std::endl;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto last_checkpoint = start;
+    auto maybe_checkpoint = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        if (!opt.checkpoint.empty() &&
+                std::chrono::duration<double>(now - last_checkpoint).count() >= opt.interval) {
+            write_checkpoint(opt, components, leibniz);
+            last_checkpoint = now;
+        }
+    };
+
+    // every round gives one block to each thread and appends the result
+    // to the running state
+    while (leibniz.next < leibniz.steps && opt.kind == series_kind::leibniz) {
+        const size_t first = leibniz.next;
+        const size_t blocks = std::min(opt.threads, (leibniz.steps - first + opt.block - 1) / opt.block);
+        std::vector<my_float> partial(blocks);
+        run_workers(blocks, [&](size_t id) {
+            size_t b = first + id * opt.block;
+            partial[id] = leibniz_block(b, std::min(leibniz.steps, b + opt.block));
+        });
+        for (auto value : partial) {
+            leibniz_add(leibniz, value);
+        }
+        leibniz.next = std::min(leibniz.steps, first + blocks * opt.block);
+        maybe_checkpoint();
+    }
+    for (auto &c : components) {
+        while (c.next < c.terms) {
+            const size_t first = c.next;
+            const size_t blocks = std::min(opt.threads, (c.terms - first + opt.block - 1) / opt.block);
+            std::vector<split_state> partial(blocks);
+            run_workers(blocks, [&](size_t id) {
+                size_t b = first + id * opt.block;
+                partial[id] = split(c, b, std::min(c.terms, b + opt.block));
+            });
+            c.state = combine(c.state, combine_tree(partial));
+            c.next = std::min(c.terms, first + blocks * opt.block);
+            maybe_checkpoint();
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    std::string result;
+    if (opt.kind == series_kind::leibniz) {
+        std::ostringstream ss;
+        ss.precision(std::numeric_limits<my_float>::digits10 + 1);
+        ss << 4 * (leibniz.sum + leibniz.compensation);
+        result = ss.str();
+    } else {
+        result = finish(opt, components);
+    }
+
+    if (!opt.checkpoint.empty()) {
+        write_checkpoint(opt, components, leibniz);
+    }
+
+    if (opt.output.empty()) {
+        std::cout << result << std::endl;
+    } else {
+        std::ofstream(opt.output) << result << std::endl;
+    }
+    std::cerr << kind_name(opt.kind) << " " << opt.n << " in "
+        << std::chrono::duration<double>(stop - start).count() << " s with "
+        << opt.threads << " threads" << std::endl;
+}
@@ -8,47 +8,26 @@
 #include <vector>
 #include <chrono>
 
-using my_float = long double;
+#include <padded_sum.hpp>
+#include <parallel_reduce.hpp>
 
-typedef struct {
-    size_t large_chunk;
-    size_t small_chunk;
-    size_t split_item;
-} chunk_info;
-
-// For a given number of iterations N and threads
-// the iterations are divided:
-// N % threads receive N / threads + 1 iterations
-// the rest receive N / threads
-constexpr chunk_info
-split_evenly(size_t N, size_t threads)
-{
-    return {N / threads + 1, N / threads, N % threads};
-}
+using my_float = long double;
 
-std::pair<size_t, size_t>
-get_chunk_begin_end(const chunk_info& ci, size_t index)
-{
-    size_t begin = 0, end = 0;
-    if (index < ci.split_item ) {
-        begin = index*ci.large_chunk;
-        end = begin + ci.large_chunk; // (index + 1) * ci.large_chunk
-    } else {
-        begin = ci.split_item*ci.large_chunk + (index - ci.split_item) * ci.small_chunk;
-        end = begin + ci.small_chunk;
-    }
-    return std::make_pair(begin, end);
-}
+// one partial sum per thread on its own cache line
+using partial_sum = padded_sum<my_float>;
 
 void
-pi_taylor_chunk(std::vector<my_float> &output,
+pi_taylor_chunk(std::vector<partial_sum> &output,
         size_t thread_id, size_t start_step, size_t stop_step) {
 
+    // accumulate locally and publish once
+    my_float sum = 0.0f;
     int sign = start_step & 0x1 ? -1 : 1;
     for (size_t n = start_step; n < stop_step; n++) {
-        output[thread_id] += sign / static_cast<float>(2 * n + 1);
+        sum += sign / static_cast<my_float>(2 * n + 1);
         sign = -sign;
     }
+    output[thread_id].value = sum;
 }
 
 std::pair<size_t, size_t>
@@ -84,7 +63,7 @@ int main(int argc, const char *argv[]) {
     std::chrono::time_point<std::chrono::system_clock> global_start, global_end;
     global_start = std::chrono::system_clock::now();
 
-    std::vector<my_float> output(threads, 0.0f);
+    std::vector<partial_sum> output(threads);
     std::vector<std::thread> thread_vector;
 
     auto chunks = split_evenly(steps, threads);
@@ -98,7 +77,7 @@ int main(int argc, const char *argv[]) {
     // wait for completion
     for(size_t i = 0; i < threads; ++i) {
         thread_vector[i].join();
-        pi += output[i];
+        pi += output[i].value;
     }
     pi *= 4.0f;
     
@@ -1,3 +1,5 @@
+#include <chrono>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <limits>
@@ -7,50 +9,373 @@
 #include <utility>
 #include <vector>
 
+#include <parallel_reduce.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PI_TAYLOR_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Family of reduction kernels for the Leibniz series, to compare accuracy
+// against time:
+//  - naive: plain running sum
+//  - kahan: Kahan compensated sum
+//  - neumaier: Kahan-Babuska-Neumaier, also safe when a term is larger
+//    than the running sum
+//  - pairwise: recursive halving with naive sums on small leaves
+// The scalar kernels accumulate in my_float. The AVX2 versions work on
+// doubles, 8 terms per iteration in two registers, with the alternating
+// sign folded into the numerators.
+
 using my_float = long double;
-/*
-void
-pi_taylor_chunk(std::vector<my_float> &output,
-        size_t thread_id, size_t start_step, size_t stop_step) {
 
+const my_float pi_reference = 3.141592653589793238462643383279502884L;
+
+// 4 * (1 - 1/3 + ... ) summed up to `steps` terms, without rounding error.
+// pi/4 minus the tail of the series, taken from the Euler-Boole expansion
+// (-1)^N * (1/(2m) + 1/(2m^2) - 1/m^4 + O(m^-6)) with m = 2N+1.
+my_float partial_sum_reference(size_t steps) {
+    const my_float m = 2 * static_cast<my_float>(steps) + 1;
+    const my_float tail = 1 / (2 * m) + 1 / (2 * m * m) - 1 / (m * m * m * m);
+    return 4 * (pi_reference / 4 - (steps & 0x1 ? -tail : tail));
+}
+
+template<typename T>
+inline T term(size_t n) {
+    return (n & 0x1 ? T(-1) : T(1)) / static_cast<T>(2 * n + 1);
+}
+
+// ################################ SCALAR KERNELS ################################
+
+my_float sum_naive(size_t begin, size_t end) {
+    my_float sum = 0;
+    for (size_t n = begin; n < end; n++) {
+        sum += term<my_float>(n);
+    }
+    return sum;
+}
+
+my_float sum_kahan(size_t begin, size_t end) {
+    my_float sum = 0, c = 0;
+    for (size_t n = begin; n < end; n++) {
+        my_float y = term<my_float>(n) - c;
+        my_float t = sum + y;
+        c = (t - sum) - y;
+        sum = t;
+    }
+    return sum - c;
+}
+
+// adds x to (sum, c) with Neumaier's correction
+template<typename T>
+inline void neumaier_add(T &sum, T &c, T x) {
+    T t = sum + x;
+    if (std::fabs(sum) >= std::fabs(x)) {
+        c += (sum - t) + x;
+    } else {
+        c += (x - t) + sum;
+    }
+    sum = t;
+}
+
+my_float sum_neumaier(size_t begin, size_t end) {
+    my_float sum = 0, c = 0;
+    for (size_t n = begin; n < end; n++) {
+        neumaier_add(sum, c, term<my_float>(n));
+    }
+    return sum + c;
+}
+
+const size_t pairwise_leaf = 256;
+
+my_float sum_pairwise(size_t begin, size_t end) {
+    if (end - begin <= pairwise_leaf) {
+        return sum_naive(begin, end);
+    }
+    size_t middle = begin + (end - begin) / 2;
+    return sum_pairwise(begin, middle) + sum_pairwise(middle, end);
+}
+
+// ################################ AVX2 KERNELS ################################
+
+#ifdef PI_TAYLOR_AVX2
+
+// terms n..n+7: lanes {n, n+1, n+2, n+3} and {n+4, .., n+7}. The step is
+// even, so the sign pattern of the numerators never changes.
+struct avx2_terms {
+    __m256d num, den0, den1;
+
+    __attribute__((target("avx2")))
+    explicit avx2_terms(size_t n) {
+        const double s = n & 0x1 ? -1.0 : 1.0;
+        const double d = static_cast<double>(2 * n + 1);
+        num = _mm256_set_pd(-s, s, -s, s);
+        den0 = _mm256_set_pd(d + 6, d + 4, d + 2, d);
+        den1 = _mm256_add_pd(den0, _mm256_set1_pd(8));
+    }
+
+    __attribute__((target("avx2")))
+    void next() {
+        const __m256d step = _mm256_set1_pd(16);
+        den0 = _mm256_add_pd(den0, step);
+        den1 = _mm256_add_pd(den1, step);
+    }
+};
+
+__attribute__((target("avx2")))
+inline double hsum(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+double sum_naive_avx2_double(size_t begin, size_t end) {
+    avx2_terms t(begin);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t n = begin;
+    for (; n + 8 <= end; n += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_div_pd(t.num, t.den0));
+        acc1 = _mm256_add_pd(acc1, _mm256_div_pd(t.num, t.den1));
+        t.next();
+    }
+    double sum = hsum(_mm256_add_pd(acc0, acc1));
+    for (; n < end; n++) {
+        sum += term<double>(n);
+    }
+    return sum;
+}
+
+my_float sum_naive_avx2(size_t begin, size_t end) {
+    return sum_naive_avx2_double(begin, end);
+}
+
+__attribute__((target("avx2")))
+inline void kahan_step(__m256d &sum, __m256d &c, __m256d x) {
+    __m256d y = _mm256_sub_pd(x, c);
+    __m256d t = _mm256_add_pd(sum, y);
+    c = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+    sum = t;
+}
+
+// lanes of (sum, c) reduced with Neumaier plus the scalar tail
+__attribute__((target("avx2")))
+my_float reduce_compensated(__m256d sum0, __m256d c0, __m256d sum1, __m256d c1,
+                            bool negate_c, size_t n, size_t end) {
+    double s[8], c[8];
+    _mm256_storeu_pd(s, sum0);
+    _mm256_storeu_pd(s + 4, sum1);
+    _mm256_storeu_pd(c, c0);
+    _mm256_storeu_pd(c + 4, c1);
+    double sum = 0, comp = 0;
+    for (int i = 0; i < 8; ++i) {
+        neumaier_add(sum, comp, s[i]);
+        comp += negate_c ? -c[i] : c[i];
+    }
+    for (; n < end; n++) {
+        neumaier_add(sum, comp, term<double>(n));
+    }
+    return static_cast<my_float>(sum) + comp;
+}
+
+__attribute__((target("avx2")))
+my_float sum_kahan_avx2(size_t begin, size_t end) {
+    avx2_terms t(begin);
+    __m256d sum0 = _mm256_setzero_pd(), c0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+    size_t n = begin;
+    for (; n + 8 <= end; n += 8) {
+        kahan_step(sum0, c0, _mm256_div_pd(t.num, t.den0));
+        kahan_step(sum1, c1, _mm256_div_pd(t.num, t.den1));
+        t.next();
+    }
+    // Kahan keeps the negated error in c
+    return reduce_compensated(sum0, c0, sum1, c1, true, n, end);
+}
+
+__attribute__((target("avx2")))
+inline void neumaier_step(__m256d &sum, __m256d &c, __m256d x) {
+    const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d t = _mm256_add_pd(sum, x);
+    __m256d sum_larger = _mm256_cmp_pd(_mm256_and_pd(sum, abs_mask),
+                                       _mm256_and_pd(x, abs_mask), _CMP_GE_OQ);
+    __m256d big = _mm256_blendv_pd(x, sum, sum_larger);
+    __m256d small = _mm256_blendv_pd(sum, x, sum_larger);
+    c = _mm256_add_pd(c, _mm256_add_pd(_mm256_sub_pd(big, t), small));
+    sum = t;
+}
+
+__attribute__((target("avx2")))
+my_float sum_neumaier_avx2(size_t begin, size_t end) {
+    avx2_terms t(begin);
+    __m256d sum0 = _mm256_setzero_pd(), c0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+    size_t n = begin;
+    for (; n + 8 <= end; n += 8) {
+        neumaier_step(sum0, c0, _mm256_div_pd(t.num, t.den0));
+        neumaier_step(sum1, c1, _mm256_div_pd(t.num, t.den1));
+        t.next();
+    }
+    return reduce_compensated(sum0, c0, sum1, c1, false, n, end);
+}
+
+// leaves of 8 * pairwise_leaf terms summed with the naive AVX2 kernel
+double sum_pairwise_avx2_double(size_t begin, size_t end) {
+    if (end - begin <= 8 * pairwise_leaf) {
+        return sum_naive_avx2_double(begin, end);
+    }
+    // keep the split on a multiple of 8 terms
+    size_t middle = begin + ((end - begin) / 2 + 7) / 8 * 8;
+    return sum_pairwise_avx2_double(begin, middle) + sum_pairwise_avx2_double(middle, end);
+}
 
+my_float sum_pairwise_avx2(size_t begin, size_t end) {
+    return sum_pairwise_avx2_double(begin, end);
+}
 
+bool has_avx2() {
+    return __builtin_cpu_supports("avx2");
 }
 
-std::pair<size_t, size_t>
+#else
+
+my_float (*const sum_naive_avx2)(size_t, size_t) = nullptr;
+my_float (*const sum_kahan_avx2)(size_t, size_t) = nullptr;
+my_float (*const sum_neumaier_avx2)(size_t, size_t) = nullptr;
+my_float (*const sum_pairwise_avx2)(size_t, size_t) = nullptr;
+
+bool has_avx2() {
+    return false;
+}
+
+#endif
+
+// ################################ DRIVER ################################
+
+using kernel_fn = my_float (*)(size_t, size_t);
+
+struct kernel_desc {
+    const char *name;
+    kernel_fn scalar;
+    kernel_fn simd;
+};
+
+const kernel_desc kernels[] = {
+    {"naive", sum_naive, sum_naive_avx2},
+    {"kahan", sum_kahan, sum_kahan_avx2},
+    {"neumaier", sum_neumaier, sum_neumaier_avx2},
+    {"pairwise", sum_pairwise, sum_pairwise_avx2},
+};
+
+// computes pi with the given kernel on every chunk of the schedule
+my_float pi_taylor(kernel_fn kernel, size_t steps, const reduce_options &ro) {
+    return 4 * parallel_reduce_ranges(size_t(0), steps, my_float(0), kernel,
+            [](my_float a, my_float b) { return a + b; }, ro);
+}
+
+struct options {
+    size_t steps;
+    size_t threads;
+    std::string kernel;  // one of kernels[] or "all"
+    bool simd;
+    reduce_options reduce;
+};
+
+options
 usage(int argc, const char *argv[]) {
+    options opt{0, 0, "all", false, reduce_options()};
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--kernel=") == 0) {
+            opt.kernel = arg.substr(9);
+        } else if (arg == "--simd") {
+            opt.simd = true;
+        } else if (arg == "--deterministic") {
+            opt.reduce.deterministic = true;
+        } else if (arg.compare(0, 8, "--chunk=") == 0) {
+            opt.reduce.chunk = std::stoll(arg.substr(8));
+        } else if (arg.compare(0, 11, "--schedule=") == 0) {
+            std::string name = arg.substr(11);
+            if (name == "block") {
+                opt.reduce.policy = schedule::block;
+            } else if (name == "cyclic") {
+                opt.reduce.policy = schedule::cyclic;
+            } else if (name == "dynamic") {
+                opt.reduce.policy = schedule::dynamic;
+            } else if (name == "guided") {
+                opt.reduce.policy = schedule::guided;
+            } else {
+                std::cerr << "Unknown schedule " << name << std::endl;
+                exit(1);
+            }
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
     // read the number of steps from the command line
-    if (argc != 3) {
-        std::cerr << "Invalid syntax: pi_taylor <steps> <threads>" << std::endl;
+    if (positional.size() != 2) {
+        std::cerr << "Invalid syntax: pi_taylor <steps> <threads> "
+            "[--kernel=naive|kahan|neumaier|pairwise|all] [--simd] "
+            "[--schedule=block|cyclic|dynamic|guided] [--chunk=<steps>] [--deterministic]" << std::endl;
         exit(1);
     }
 
-    size_t steps = std::stoll(argv[1]);
-    size_t threads = std::stoll(argv[2]);
+    opt.steps = std::stoll(positional[0]);
+    opt.threads = std::stoll(positional[1]);
+    opt.reduce.threads = opt.threads;
 
-    if (steps < threads ){
+    if (opt.steps < opt.threads ){
         std::cerr << "The number of steps should be larger than the number of threads" << std::endl;
         exit(1);
-
     }
-    return std::make_pair(steps, threads);
+    return opt;
 }
-*/
-int main() {
 
-/*
-    auto ret_pair = usage(argc, argv);
-    auto steps = ret_pair.first;
-    auto threads = ret_pair.second;
+void run(const char *name, bool simd, kernel_fn kernel, size_t steps, const reduce_options &ro) {
+    auto start = std::chrono::steady_clock::now();
+    my_float pi = pi_taylor(kernel, steps, ro);
+    auto stop = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = stop - start;
 
-    my_float pi;
+    // the distance to pi is dominated by the truncation of the series, the
+    // summation error is measured against the exact partial sum
+    std::cout << std::setw(9) << name << ", " << std::setw(6) << (simd ? "avx2" : "scalar") << ", "
+        << std::setprecision(std::numeric_limits<my_float>::digits10 + 1) << pi << ", "
+        << std::setprecision(3) << std::scientific
+        << std::fabs(pi - partial_sum_reference(steps)) << ", "
+        << std::fabs(pi - pi_reference) << ", "
+        << std::defaultfloat << elapsed_seconds.count() << std::endl;
+}
 
-    // please complete missing parts
+int main(int argc, const char *argv[]) {
 
+    auto opt = usage(argc, argv);
 
-    std::cout << "For " << steps << ", pi value: "
-        << std::setprecision(std::numeric_limits<long double>::digits10 + 1)
-        << pi << std::endl;
-        */
-}
+    bool found = false;
+    std::cout << "For " << opt.steps << " steps and " << opt.threads << " threads" << std::endl;
+    std::cout << "   kernel,   impl, pi, summation error, error to pi, time (s)" << std::endl;
+    for (const auto &k : kernels) {
+        if (opt.kernel != "all" && opt.kernel != k.name) {
+            continue;
+        }
+        found = true;
+        // "all" compares both implementations of every kernel
+        if (!opt.simd || opt.kernel == "all") {
+            run(k.name, false, k.scalar, opt.steps, opt.reduce);
+        }
+        if (opt.simd || opt.kernel == "all") {
+            if (has_avx2()) {
+                run(k.name, true, k.simd, opt.steps, opt.reduce);
+            } else {
+                std::cout << std::setw(9) << k.name << ", AVX2 not available" << std::endl;
+            }
+        }
+    }
 
+    if (!found) {
+        std::cerr << "Unknown kernel " << opt.kernel << std::endl;
+        exit(1);
+    }
+}
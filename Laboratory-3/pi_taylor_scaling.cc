@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <padded_sum.hpp>
+#include <parallel_reduce.hpp>
+
+// Scaling of pi_taylor_parallel with two layouts for the partial sums:
+//  - shared: every iteration adds into a std::vector<my_float>, threads
+//    write neighbouring elements of the same cache lines (false sharing)
+//  - padded: every thread sums locally and publishes once into its own
+//    cache line
+// For each thread count the median of several runs is reported.
+
+using my_float = long double;
+
+using partial_sum = padded_sum<my_float>;
+
+void
+pi_taylor_chunk_shared(std::vector<my_float> &output,
+        size_t thread_id, size_t start_step, size_t stop_step) {
+
+    // volatile: every iteration loads and stores the shared slot, as the
+    // old code meant to, instead of the compiler keeping it in a register
+    volatile my_float &slot = output[thread_id];
+    int sign = start_step & 0x1 ? -1 : 1;
+    for (size_t n = start_step; n < stop_step; n++) {
+        slot = slot + sign / static_cast<my_float>(2 * n + 1);
+        sign = -sign;
+    }
+}
+
+void
+pi_taylor_chunk_padded(std::vector<partial_sum> &output,
+        size_t thread_id, size_t start_step, size_t stop_step) {
+
+    my_float sum = 0.0f;
+    int sign = start_step & 0x1 ? -1 : 1;
+    for (size_t n = start_step; n < stop_step; n++) {
+        sum += sign / static_cast<my_float>(2 * n + 1);
+        sign = -sign;
+    }
+    output[thread_id].value = sum;
+}
+
+// run one of the layouts with the given threads, returns the time in seconds
+double run_shared(size_t steps, size_t threads) {
+    std::vector<my_float> output(threads, 0.0f);
+    std::vector<std::thread> thread_vector;
+    auto chunks = split_evenly(steps, threads);
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < threads; ++i) {
+        auto begin_end = get_chunk_begin_end(chunks, i);
+        thread_vector.push_back(std::thread(pi_taylor_chunk_shared, std::ref(output), i,
+                    begin_end.first, begin_end.second));
+    }
+    for(auto &t : thread_vector) {
+        t.join();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+double run_padded(size_t steps, size_t threads) {
+    std::vector<partial_sum> output(threads);
+    std::vector<std::thread> thread_vector;
+    auto chunks = split_evenly(steps, threads);
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < threads; ++i) {
+        auto begin_end = get_chunk_begin_end(chunks, i);
+        thread_vector.push_back(std::thread(pi_taylor_chunk_padded, std::ref(output), i,
+                    begin_end.first, begin_end.second));
+    }
+    for(auto &t : thread_vector) {
+        t.join();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t m = v.size() / 2;
+    return v.size() % 2 ? v[m] : (v[m - 1] + v[m]) / 2;
+}
+
+int main(int argc, const char *argv[]) {
+
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Invalid syntax: pi_taylor_scaling <steps> [max_threads] [repetitions]" << std::endl;
+        exit(1);
+    }
+
+    size_t steps = std::stoll(argv[1]);
+    size_t max_threads = argc > 2 ? std::stoll(argv[2]) : std::thread::hardware_concurrency();
+    size_t repetitions = argc > 3 ? std::stoll(argv[3]) : 5;
+
+    if (steps < max_threads || max_threads == 0 || repetitions == 0) {
+        std::cerr << "The number of steps should be larger than the number of threads" << std::endl;
+        exit(1);
+    }
+
+    std::cout << "threads, shared (s), padded (s), shared speedup, padded speedup" << std::endl;
+    double shared_base = 0, padded_base = 0;
+    for(size_t threads = 1; threads <= max_threads; ++threads) {
+        std::vector<double> shared_times, padded_times;
+        for(size_t r = 0; r < repetitions; ++r) {
+            // interleave both layouts so they see the same machine state
+            shared_times.push_back(run_shared(steps, threads));
+            padded_times.push_back(run_padded(steps, threads));
+        }
+        double shared = median(shared_times), padded = median(padded_times);
+        if (threads == 1) {
+            shared_base = shared;
+            padded_base = padded;
+        }
+        std::cout << threads << ", " << shared << ", " << padded << ", "
+            << shared_base / shared << ", " << padded_base / padded << std::endl;
+    }
+}
@@ -8,10 +8,10 @@ using my_float = long double;
 
 my_float pi_taylor(size_t steps) {
     int sign = 1;
-    float sum = 0;
+    my_float sum = 0;
 
     for (size_t n = 0; n < steps; n++) {
-        sum += sign / static_cast<float>(2 * n + 1);
+        sum += sign / static_cast<my_float>(2 * n + 1);
         sign = -sign;
     }
 
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Render with every framebuffer layout for several region divisions and
+# collect the timings in a CSV file.
+# Usage: benchmark_layouts.sh <smallpt_thread_pool binary> [output.csv]
+
+[ $# -ge 1 ] || { echo "Usage: $0 <smallpt_thread_pool> [output.csv]"; exit 1; }
+
+binary="$(cd "$(dirname "$1")" && pwd)/$(basename "$1")"
+output="${2:-layouts.csv}"
+work_dir="$(mktemp -d)"
+
+divisions=("1 1" "2 2" "4 4" "8 8" "16 16" "64 1" "1 64" "256 4" "4 192")
+layouts=(row tiled morton)
+
+echo "layout,w_div,h_div,seconds,rays_per_sec" > "${output}"
+for division in "${divisions[@]}"; do
+    set -- ${division}
+    for layout in "${layouts[@]}"; do
+        stats="${work_dir}/${layout}_$1_$2.json"
+        (cd "${work_dir}" && "${binary}" --layout="${layout}" --stats="${stats}" "$1" "$2" > /dev/null) || exit 1
+        seconds=$(sed -n 's/.*"seconds": \([0-9.e+-]*\),/\1/p' "${stats}")
+        rays=$(sed -n 's/.*"rays_per_sec": \([0-9.e+-]*\),/\1/p' "${stats}")
+        echo "${layout},$1,$2,${seconds},${rays}" | tee -a "${output}"
+    done
+done
+
+rm -rf "${work_dir}"
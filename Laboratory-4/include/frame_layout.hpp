@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+// Storage order of the pixels of a framebuffer.
+//  - row_major: the classic image, (h-y-1)*w+x
+//  - tiled: tile x tile blocks stored one after the other, rows inside
+//  - morton: same blocks, pixels inside a block in Z-order
+// Blocks are stored row by row from the top of the image, and every block
+// starts on a cache line as long as the buffer does (see make_aligned).
+enum class layout_type { row_major, tiled, morton };
+
+inline bool parse_layout(const std::string& name, layout_type& type)
+{
+  if (name == "row") {
+    type = layout_type::row_major;
+  } else if (name == "tiled") {
+    type = layout_type::tiled;
+  } else if (name == "morton") {
+    type = layout_type::morton;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline const char* layout_name(layout_type type)
+{
+  switch (type) {
+    case layout_type::tiled: return "tiled";
+    case layout_type::morton: return "morton";
+    default: return "row";
+  }
+}
+
+// interleave the lower 16 bits of x and y: ...y1x1y0x0
+inline unsigned morton_encode(unsigned x, unsigned y)
+{
+  auto spread = [](unsigned v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+class frame_layout
+{
+  layout_type _type;
+  int _w, _h;
+  int _tile_shift;  // log2 of the tile side
+  int _tiles_x, _tiles_y;
+
+  public:
+  // tile must be a power of two; a multiple of 8 keeps each tile row of
+  // 24-byte pixels on whole cache lines
+  frame_layout(layout_type type, int w, int h, int tile = 8)
+    : _type(type), _w(w), _h(h), _tile_shift(0)
+  {
+    while ((1 << _tile_shift) < tile) {
+      ++_tile_shift;
+    }
+    _tiles_x = (w + tile - 1) >> _tile_shift;
+    _tiles_y = (h + tile - 1) >> _tile_shift;
+  }
+
+  layout_type type() const { return _type; }
+  int tile() const { return 1 << _tile_shift; }
+
+  // region boundaries must fall on multiples of this to give every task
+  // whole tiles
+  int granularity() const { return _type == layout_type::row_major ? 1 : tile(); }
+
+  // number of elements to allocate, blocks on the borders are padded
+  size_t size() const
+  {
+    if (_type == layout_type::row_major) {
+      return size_t(_w) * _h;
+    }
+    return size_t(_tiles_x) * _tiles_y << (2 * _tile_shift);
+  }
+
+  // storage index of pixel (x, y), with y growing upwards as in smallpt
+  size_t index(int x, int y) const
+  {
+    const int r = _h - y - 1; // image row, top to bottom
+    if (_type == layout_type::row_major) {
+      return size_t(r) * _w + x;
+    }
+    const int mask = (1 << _tile_shift) - 1;
+    const size_t block = (size_t(r >> _tile_shift) * _tiles_x + (x >> _tile_shift))
+      << (2 * _tile_shift);
+    if (_type == layout_type::tiled) {
+      return block + ((r & mask) << _tile_shift) + (x & mask);
+    }
+    return block + morton_encode(x & mask, r & mask);
+  }
+};
+
+// cache line aligned arrays, so blocks owned by different tasks never share
+// a line. Only for trivially destructible types, the memory is just freed.
+struct aligned_deleter
+{
+  void operator()(void* p) const { free(p); }
+};
+
+template<typename T>
+using aligned_array = std::unique_ptr<T[], aligned_deleter>;
+
+template<typename T>
+aligned_array<T> make_aligned(size_t n, size_t alignment = 64)
+{
+  void* p = nullptr;
+  if (posix_memalign(&p, alignment, n * sizeof(T)) != 0) {
+    throw std::bad_alloc();
+  }
+  T* data = static_cast<T*>(p);
+  for (size_t i = 0; i < n; ++i) {
+    new (data + i) T();
+  }
+  return aligned_array<T>(data);
+}
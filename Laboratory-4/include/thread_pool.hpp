@@ -10,6 +10,7 @@
 class thread_pool
 {
   std::atomic<bool> _done;
+  std::atomic<size_t> _pending; // submitted tasks not yet finished
   size_t _thread_count;
   threadsafe_queue<std::function<void()>> _work_queue;
   std::vector<std::thread> _threads;
@@ -23,6 +24,7 @@ class thread_pool
       std::function<task_type> task;
       if (_work_queue.try_pop(task)) {
         task();
+        --_pending;
       } else {
         std::this_thread::yield();
       }
@@ -31,7 +33,7 @@ class thread_pool
 
   public:
   thread_pool(size_t num_threads = std::thread::hardware_concurrency())
-    : _done(false), _thread_count(num_threads), _joiner(_threads)
+    : _done(false), _pending(0), _thread_count(num_threads), _joiner(_threads)
   {
       for (size_t i = 0; i < _thread_count; ++i) {
         _threads.push_back(std::thread(&thread_pool::worker_thread, this));
@@ -57,9 +59,26 @@ class thread_pool
       _joiner.~join_threads();
   }
 
+  // wait until every submitted task has finished, but keep the workers
+  // alive so the pool can be reused (e.g. frame after frame)
+  void wait_tasks()
+  {
+      // active waiting, the calling thread helps with the pending work
+      while(_pending != 0) {
+        std::function<task_type> task;
+        if (_work_queue.try_pop(task)) {
+          task();
+          --_pending;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+  }
+
   template<typename F>
     void submit(F f)
     {
+      ++_pending;
       _work_queue.push(std::function<task_type>(f));
     }
 };
@@ -18,15 +18,20 @@
 // 7
 // 8   32
 
-#include <atomic>
+#include <algorithm>
 #include <cmath>
 #include <chrono>
 #include <fstream>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <frame_layout.hpp>
 #include <thread_pool.hpp>
 
 // Vec is a structure to store position (x,y,z) and color (r,g,b)
@@ -66,12 +71,33 @@ struct Ray {
 // material types, used in radiance()
 enum Refl_t { DIFF, SPEC, REFR };
 
+// Procedural checkerboard in world space, replaces the colour of a material
+struct Texture {
+    Vec a, b;         // the two colours
+    double scale;     // side of a square
+    Vec eval(const Vec &x) const {
+        long k = long(floor(x.x/scale)) + long(floor(x.y/scale)) + long(floor(x.z/scale));
+        return k & 1 ? b : a;
+    }
+};
+
+// Materials are data: primitives only keep a 16-bit index into the table
+struct Material {
+    Refl_t refl;      // reflection type (DIFFuse, SPECular, REFRactive)
+    Vec e, c;         // emission, color
+    double ior;       // index of refraction, REFR only
+    double roughness; // 0 is a perfect mirror, SPEC only
+    int texture;      // index in Scene::textures, -1 for a plain colour
+    Material(Refl_t refl_, Vec e_, Vec c_, double ior_=1.5, double roughness_=0, int texture_=-1):
+        refl(refl_), e(e_), c(c_), ior(ior_), roughness(roughness_), texture(texture_) {}
+};
+
 struct Sphere {
     double rad;       // radius
-    Vec p, e, c;      // position, emission, color
-    Refl_t refl;      // reflection type (DIFFuse, SPECular, REFRactive)
-    Sphere(double rad_, Vec p_, Vec e_, Vec c_, Refl_t refl_):
-        rad(rad_), p(p_), e(e_), c(c_), refl(refl_) {}
+    Vec p;            // position, in geometry space
+    unsigned short material;
+    Sphere(double rad_, Vec p_, unsigned short material_):
+        rad(rad_), p(p_), material(material_) {}
     double intersect(const Ray &r) const {
         // returns distance, 0 if nohit
         Vec op = p-r.o; // Solve t^2*d.d + 2*t*(o-p).d + (o-p).(o-p)-R^2 = 0
@@ -86,81 +112,218 @@ struct Sphere {
     }
 };
 
-//Scene: radius, position, emission, color, material
-Sphere spheres[] = {
-    Sphere(1e5, Vec( 1e5+1,40.8,81.6), Vec(),Vec(.75,.25,.25),DIFF),//Left
-    Sphere(1e5, Vec(-1e5+99,40.8,81.6),Vec(),Vec(.25,.25,.75),DIFF),//Rght
-    Sphere(1e5, Vec(50,40.8, 1e5),     Vec(),Vec(.75,.75,.75),DIFF),//Back
-    Sphere(1e5, Vec(50,40.8,-1e5+170), Vec(),Vec(),           DIFF),//Frnt
-    Sphere(1e5, Vec(50, 1e5, 81.6),    Vec(),Vec(.75,.75,.75),DIFF),//Botm
-    Sphere(1e5, Vec(50,-1e5+81.6,81.6),Vec(),Vec(.75,.75,.75),DIFF),//Top
-    Sphere(16.5,Vec(27,16.5,47),       Vec(),Vec(1,1,1)*.999, SPEC),//Mirr
-    Sphere(16.5,Vec(73,16.5,78),       Vec(),Vec(1,1,1)*.999, REFR),//Glas
-    Sphere(600, Vec(50,681.6-.27,81.6),Vec(12,12,12),  Vec(), DIFF) //Lite
+// A geometry is a range of spheres of the primitive table. Instances place
+// a geometry in the world with a translation and a uniform scale, and may
+// override the material of all its spheres, so repeated objects are stored
+// once.
+struct Geometry {
+    unsigned first, count;
+};
+
+struct Instance {
+    unsigned geometry;
+    Vec translate;
+    double scale;
+    int material;     // -1 keeps the materials of the geometry
+};
+
+struct Scene {
+    std::vector<Material> materials;
+    std::vector<Texture> textures;
+    std::vector<Sphere> primitives;
+    std::vector<Geometry> geometries;
+    std::vector<Instance> instances;
+
+    unsigned short add_material(const Material &m) {
+        materials.push_back(m);
+        return static_cast<unsigned short>(materials.size() - 1);
+    }
+    unsigned add_geometry(const std::vector<Sphere> &spheres) {
+        geometries.push_back(Geometry{unsigned(primitives.size()), unsigned(spheres.size())});
+        primitives.insert(primitives.end(), spheres.begin(), spheres.end());
+        return unsigned(geometries.size() - 1);
+    }
+    void add_instance(unsigned geometry, Vec translate, double scale=1, int material=-1) {
+        instances.push_back(Instance{geometry, translate, scale, material});
+    }
 };
 
+Scene scene;
+
+// Classic smallpt Cornell box: the room is one geometry and both balls are
+// instances of a single sphere
+void build_cornell_scene(Scene &sc) {
+    unsigned short red = sc.add_material(Material(DIFF, Vec(), Vec(.75,.25,.25)));
+    unsigned short blue = sc.add_material(Material(DIFF, Vec(), Vec(.25,.25,.75)));
+    unsigned short grey = sc.add_material(Material(DIFF, Vec(), Vec(.75,.75,.75)));
+    unsigned short black = sc.add_material(Material(DIFF, Vec(), Vec()));
+    unsigned short light = sc.add_material(Material(DIFF, Vec(12,12,12), Vec()));
+    unsigned short mirror = sc.add_material(Material(SPEC, Vec(), Vec(1,1,1)*.999));
+    unsigned short glass = sc.add_material(Material(REFR, Vec(), Vec(1,1,1)*.999, 1.5));
+
+    //Room: radius, position, material
+    unsigned room = sc.add_geometry({
+        Sphere(1e5, Vec( 1e5+1,40.8,81.6), red),  //Left
+        Sphere(1e5, Vec(-1e5+99,40.8,81.6),blue), //Rght
+        Sphere(1e5, Vec(50,40.8, 1e5),     grey), //Back
+        Sphere(1e5, Vec(50,40.8,-1e5+170), black),//Frnt
+        Sphere(1e5, Vec(50, 1e5, 81.6),    grey), //Botm
+        Sphere(1e5, Vec(50,-1e5+81.6,81.6),grey), //Top
+        Sphere(600, Vec(50,681.6-.27,81.6),light) //Lite
+    });
+    unsigned ball = sc.add_geometry({ Sphere(16.5, Vec(), grey) });
+
+    sc.add_instance(room, Vec());
+    sc.add_instance(ball, Vec(27,16.5,47), 1, mirror); //Mirr
+    sc.add_instance(ball, Vec(73,16.5,78), 1, glass);  //Glas
+}
+
+// Same room with a checkered floor and a grid of small balls of assorted
+// materials, all instances of one sphere
+void build_balls_scene(Scene &sc) {
+    build_cornell_scene(sc);
+    int checker = int(sc.textures.size());
+    sc.textures.push_back(Texture{Vec(.75,.75,.75), Vec(.2,.2,.2), 10});
+    sc.primitives[4].material = sc.add_material(Material(DIFF, Vec(), Vec(), 1.5, 0, checker)); // Botm
+
+    std::vector<unsigned short> mats = {
+        sc.add_material(Material(DIFF, Vec(), Vec(.8,.6,.2))),
+        sc.add_material(Material(SPEC, Vec(), Vec(.9,.9,.9), 1.5, 0.1)),
+        sc.add_material(Material(SPEC, Vec(), Vec(.95,.7,.4), 1.5, 0.3)),
+        sc.add_material(Material(REFR, Vec(), Vec(1,1,1)*.999, 1.33)),
+        sc.add_material(Material(REFR, Vec(), Vec(.7,.9,1), 2.4)),
+    };
+    const unsigned ball = 1;
+    const double scale = 4/16.5; // radius 4
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            sc.add_instance(ball, Vec(15 + 17.5*i, 4, 100 + 15*j), scale, mats[(i+j) % mats.size()]);
+        }
+    }
+}
+
 inline double clamp(double x){ return x<0 ? 0 : x>1 ? 1 : x; }
 
 inline int toInt(double x){ return int(pow(clamp(x),1/2.2)*255+.5); }
 
-inline bool intersect(const Ray &r, double &t, int &id) {
-    double n=sizeof(spheres)/sizeof(Sphere), d, inf=t=1e20;
-    for(int i=int(n);i--;) {
-        if((d=spheres[i].intersect(r))&&d<t){
-            t=d;
-            id=i;
+// Closest hit of the ray against every instance; the ray is moved to the
+// space of each geometry instead of transforming the spheres
+inline bool intersect(const Ray &r, double &t, int &inst, int &prim) {
+    double d, inf=t=1e20;
+    for(int i=int(scene.instances.size());i--;) {
+        const Instance &in = scene.instances[i];
+        const Geometry &g = scene.geometries[in.geometry];
+        Ray local((r.o-in.translate)*(1/in.scale), r.d);
+        for(int k=int(g.first+g.count); k-- > int(g.first);) {
+            if((d=scene.primitives[k].intersect(local)*in.scale)&&d<t){
+                t=d;
+                inst=i;
+                prim=k;
+            }
         }
     }
     return t<inf;
 }
 
-std::atomic<int> max_depth{0};
+// World space centre and material of a hit primitive
+inline const Material &hit_material(int inst, int prim, Vec &centre) {
+    const Instance &in = scene.instances[inst];
+    const Sphere &sp = scene.primitives[prim];
+    centre = in.translate + sp.p*in.scale;
+    return scene.materials[in.material < 0 ? sp.material : in.material];
+}
+
+inline Vec albedo(const Material &m, const Vec &x) {
+    return m.texture < 0 ? m.c : scene.textures[m.texture].eval(x);
+}
+
+// Render statistics. Every render() task accumulates into its own local
+// copy and publishes it once at the end, so radiance() never writes shared
+// memory; main() merges the per-task copies after the pool has finished.
+struct RenderStats {
+    static const int histogram_size = 32;   // last bucket collects deeper paths
+
+    unsigned long long rays = 0;            // rays traced (calls to radiance)
+    unsigned long long camera_rays = 0;     // primary rays
+    unsigned long long rr_terminations = 0; // paths killed by Russian roulette
+    int max_depth = 0;                      // deepest bounce reached
+    unsigned long long path_depth[histogram_size] = {}; // path length histogram
+
+    void path_end(int depth) {
+        path_depth[depth < histogram_size ? depth : histogram_size - 1]++;
+    }
+
+    void merge(const RenderStats &other) {
+        rays += other.rays;
+        camera_rays += other.camera_rays;
+        rr_terminations += other.rr_terminations;
+        max_depth = std::max(max_depth, other.max_depth);
+        for (int i = 0; i < histogram_size; ++i) {
+            path_depth[i] += other.path_depth[i];
+        }
+    }
+};
 
-Vec radiance(const Ray &r, int depth, unsigned short *Xi){
+Vec radiance(const Ray &r, int depth, unsigned short *Xi, RenderStats &stats){
     double t;                               // distance to intersection
-    int id=0;                               // id of intersected object
-    if (!intersect(r, t, id)) {
+    int inst=0, prim=0;                     // ids of intersected instance and sphere
+    stats.rays++;
+    if (!intersect(r, t, inst, prim)) {
+        stats.path_end(depth);
         return Vec();  // if miss, return black
     }
-    const Sphere &obj = spheres[id];        // the hit object
-    Vec x=r.o+r.d*t, n=(x-obj.p).norm(), nl=n.dot(r.d)<0?n:n*-1, f=obj.c;
+    Vec centre;
+    const Material &obj = hit_material(inst, prim, centre); // the hit material
+    Vec x=r.o+r.d*t, n=(x-centre).norm(), nl=n.dot(r.d)<0?n:n*-1, f=albedo(obj, x);
     double p = f.x>f.y && f.x>f.z ? f.x : f.y>f.z ? f.y : f.z; // max refl
     if (++depth>5) {
         if (erand48(Xi)<p){
             f=f*(1/p);
         }
         else{
+            stats.rr_terminations++;
+            stats.path_end(depth);
             return obj.e; //R.R.
         }
     }
-#if 1
-    // RALLEN this isn't a good CAS, but is "good enough"
-    if(depth > max_depth) {
-        max_depth = depth;
+    if (depth > stats.max_depth) {
+        stats.max_depth = depth;
     }
-#endif
-    if (obj.refl == DIFF) {
+    switch (obj.refl) {
+    case DIFF: {
         // Ideal DIFFUSE reflection
         double r1=2*M_PI*erand48(Xi), r2=erand48(Xi), r2s=sqrt(r2);
         Vec w=nl, u=((fabs(w.x)>.1?Vec(0,1):Vec(1))%w).norm(), v=w%u;
         Vec d = (u*cos(r1)*r2s + v*sin(r1)*r2s + w*sqrt(1-r2)).norm();
-        return obj.e + f.mult(radiance(Ray(x,d),depth,Xi));
-    } else if (obj.refl == SPEC) {
-        // Ideal SPECULAR reflection
-        return obj.e + f.mult(radiance(Ray(x,r.d-n*2*n.dot(r.d)),depth,Xi));
+        return obj.e + f.mult(radiance(Ray(x,d),depth,Xi,stats));
+    }
+    case SPEC: {
+        // SPECULAR reflection, glossy when the material is rough
+        Vec d = r.d-n*2*n.dot(r.d);
+        if (obj.roughness > 0) {
+            Vec g(2*erand48(Xi)-1, 2*erand48(Xi)-1, 2*erand48(Xi)-1);
+            Vec dg = (d + g*obj.roughness).norm();
+            if (dg.dot(nl) > 0) {           // keep it above the surface
+                d = dg;
+            }
+        }
+        return obj.e + f.mult(radiance(Ray(x,d),depth,Xi,stats));
+    }
+    case REFR:
+        break;
     }
     Ray reflRay(x, r.d-n*2*n.dot(r.d));     // Ideal dielectric REFRACTION
     bool into = n.dot(nl)>0;                // Ray from outside going in?
-    double nc=1, nt=1.5, nnt=into?nc/nt:nt/nc, ddn=r.d.dot(nl), cos2t;
+    double nc=1, nt=obj.ior, nnt=into?nc/nt:nt/nc, ddn=r.d.dot(nl), cos2t;
     if ((cos2t=1-nnt*nnt*(1-ddn*ddn))<0) {    // Total internal reflection
-        return obj.e + f.mult(radiance(reflRay,depth,Xi));
+        return obj.e + f.mult(radiance(reflRay,depth,Xi,stats));
     }
     Vec tdir = (r.d*nnt - n*((into?1:-1)*(ddn*nnt+sqrt(cos2t)))).norm();
     double a=nt-nc, b=nt+nc, R0=a*a/(b*b), c = 1-(into?-ddn:tdir.dot(n));
     double Re=R0+(1-R0)*c*c*c*c*c,Tr=1-Re,P=.25+.5*Re,RP=Re/P,TP=Tr/(1-P);
     return obj.e + f.mult(depth>2 ? (erand48(Xi)<P ?   // Russian roulette
-                                     radiance(reflRay,depth,Xi)*RP:radiance(Ray(x,tdir),depth,Xi)*TP) :
-                          radiance(reflRay,depth,Xi)*Re+radiance(Ray(x,tdir),depth,Xi)*Tr);
+                                     radiance(reflRay,depth,Xi,stats)*RP:radiance(Ray(x,tdir),depth,Xi,stats)*TP) :
+                          radiance(reflRay,depth,Xi,stats)*Re+radiance(Ray(x,tdir),depth,Xi,stats)*Tr);
 }
 
 
@@ -175,16 +338,51 @@ struct Region {
     }
 };
 
+// Auxiliary buffers filled from the first hit of each pixel, used to guide
+// the denoiser. Same layout as the framebuffer.
+struct AuxBuffers {
+    aligned_array<Vec> albedo;
+    aligned_array<Vec> normal;
+    aligned_array<double> depth;
+    explicit AuxBuffers(size_t size) :
+        albedo(make_aligned<Vec>(size)), normal(make_aligned<Vec>(size)),
+        depth(make_aligned<double>(size)) {}
+};
+
+// Trace the ray through the pixel centre and record what it sees first
+inline void first_hit(const Ray &r, AuxBuffers *aux, size_t i) {
+    double t;
+    int inst=0, prim=0;
+    if (!intersect(r, t, inst, prim)) {
+        aux->albedo[i] = Vec();
+        aux->normal[i] = Vec();
+        aux->depth[i] = 1e20;
+        return;
+    }
+    Vec centre;
+    const Material &obj = hit_material(inst, prim, centre);
+    Vec x=r.o+r.d*t, n=(x-centre).norm();
+    aux->albedo[i] = albedo(obj, x) + obj.e;
+    aux->normal[i] = n.dot(r.d)<0?n:n*-1;
+    aux->depth[i] = t;
+}
+
 void render(int w, int h, int samps, Ray cam,
-            Vec cx, Vec cy, Vec *c,
-            const Region reg
+            Vec cx, Vec cy, Vec *c, const frame_layout &layout,
+            const Region reg, RenderStats *stats, AuxBuffers *aux
     ) {
     int y0 = reg.y0, y1 = reg.y1;
     int x0 = reg.x0, x1 = reg.x1;
+    RenderStats local;
 
     for (int y=y0; y<y1; y++) {                       // Loop over image rows
         for (unsigned short x=x0, Xi[3]={0,0,static_cast<unsigned short>(y*y*y)}; x<x1; x++) {   // Loop cols
-            for (int sy=0, i=(h-y-1)*w+x; sy<2; sy++) {     // 2x2 subpixel rows
+            if (aux) {
+                Vec d = cx*((x+.5)/w - .5) + cy*((y+.5)/h - .5) + cam.d;
+                first_hit(Ray(cam.o+d*140,d.norm()), aux, layout.index(x, y));
+            }
+            const size_t i = layout.index(x, y);
+            for (int sy=0; sy<2; sy++) {                    // 2x2 subpixel rows
                 for (int sx=0; sx<2; sx++) {        // 2x2 subpixel cols
                     Vec r{0.0, 0.0, 0.0};
                     for (int s=0; s<samps; s++) {
@@ -192,91 +390,401 @@ void render(int w, int h, int samps, Ray cam,
                         double r2=2*erand48(Xi), dy=r2<1 ? sqrt(r2)-1: 1-sqrt(2-r2);
                         Vec d = cx*( ( (sx+.5 + dx)/2 + x)/w - .5) +
                                                        cy*( ( (sy+.5 + dy)/2 + y)/h - .5) + cam.d;
-                        r = r + radiance(Ray(cam.o+d*140,d.norm()),0,Xi)*(1./samps);
+                        r = r + radiance(Ray(cam.o+d*140,d.norm()),0,Xi,local)*(1./samps);
                     } // Camera rays are pushed ^^^^^ forward to start in interior
                     c[i] = c[i] + Vec(clamp(r.x),clamp(r.y),clamp(r.z))*.25;
                 }
             }
         }
     }
+    local.camera_rays = 4ull * samps * (y1 - y0) * (x1 - x0);
+    *stats = local; // publish once
+}
+
+// Joint (cross) bilateral filter guided by the auxiliary buffers. The
+// weight of a neighbour drops with its distance, its colour difference and
+// any change of albedo, normal or depth, so edges and texture survive while
+// the Monte Carlo noise is smoothed. Each task filters one region reading
+// from `in` and writing to `out`, so regions can run in parallel.
+struct DenoiseParams {
+    int radius = 4;
+    double sigma_spatial = 2.0;
+    double sigma_color = 1.0;
+    double sigma_albedo = 0.1;
+    double sigma_normal = 0.2;   // on 1 - cos(angle)
+    double sigma_depth = 0.05;   // relative to the depth of the centre pixel
+};
+
+void denoise(int w, int h, const Vec *in, Vec *out, const AuxBuffers *aux,
+             const frame_layout &layout, const Region reg, const DenoiseParams &prm)
+{
+    const double inv_s = 1.0 / (2 * prm.sigma_spatial * prm.sigma_spatial);
+    const double inv_c = 1.0 / (2 * prm.sigma_color * prm.sigma_color);
+    const double inv_a = 1.0 / (2 * prm.sigma_albedo * prm.sigma_albedo);
+    const double inv_n = 1.0 / prm.sigma_normal;
+    const double inv_d = 1.0 / (2 * prm.sigma_depth * prm.sigma_depth);
+
+    for (int y = reg.y0; y < reg.y1; y++) {
+        for (int x = reg.x0; x < reg.x1; x++) {
+            const size_t i = layout.index(x, y);
+            const Vec &ci = in[i], &ai = aux->albedo[i], &ni = aux->normal[i];
+            const double di = aux->depth[i];
+            Vec sum;
+            double wsum = 0;
+            for (int ky = std::max(y - prm.radius, 0); ky <= std::min(y + prm.radius, h - 1); ky++) {
+                for (int kx = std::max(x - prm.radius, 0); kx <= std::min(x + prm.radius, w - 1); kx++) {
+                    const size_t j = layout.index(kx, ky);
+                    const Vec dc = in[j] - ci, da = aux->albedo[j] - ai;
+                    const double dd = (aux->depth[j] - di) / di;
+                    const double e = ((kx-x)*(kx-x) + (ky-y)*(ky-y)) * inv_s
+                        + dc.dot(dc) * inv_c
+                        + da.dot(da) * inv_a
+                        + (1 - aux->normal[j].dot(ni)) * inv_n
+                        + dd * dd * inv_d;
+                    const double wj = exp(-e);
+                    sum = sum + in[j] * wj;
+                    wsum += wj;
+                }
+            }
+            out[i] = sum * (1 / wsum); // the centre pixel always has weight 1
+        }
+    }
 }
 
-std::pair<size_t, size_t>
+struct Options {
+    size_t w_div = 2;
+    size_t h_div = 2;
+    bool stats = false;
+    std::string stats_file = "smallpt_stats.json";
+    std::string camera_path;    // batch mode: one camera per line, one frame each
+    bool denoise = false;
+    DenoiseParams denoise_params;
+    layout_type layout = layout_type::row_major;
+    int tile = 8;
+    std::string scene = "cornell";
+};
+
+Options
 usage(int argc, char *argv[], size_t w, size_t h) {
+    Options opt;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            opt.stats = true;
+        } else if (arg.compare(0, 8, "--stats=") == 0) {
+            opt.stats = true;
+            opt.stats_file = arg.substr(8);
+        } else if (arg.compare(0, 9, "--frames=") == 0) {
+            opt.camera_path = arg.substr(9);
+        } else if (arg.compare(0, 9, "--layout=") == 0) {
+            if (!parse_layout(arg.substr(9), opt.layout)) {
+                std::cerr << "Unknown layout " << arg.substr(9) << ", use row, tiled or morton" << std::endl;
+                exit(1);
+            }
+        } else if (arg.compare(0, 7, "--tile=") == 0) {
+            opt.tile = std::stoi(arg.substr(7));
+        } else if (arg.compare(0, 8, "--scene=") == 0) {
+            opt.scene = arg.substr(8);
+            if (opt.scene != "cornell" && opt.scene != "balls") {
+                std::cerr << "Unknown scene " << opt.scene << ", use cornell or balls" << std::endl;
+                exit(1);
+            }
+        } else if (arg == "--denoise") {
+            opt.denoise = true;
+        } else if (arg.compare(0, 10, "--denoise=") == 0) {
+            opt.denoise = true;
+            opt.denoise_params.radius = std::stoi(arg.substr(10));
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
     // read the number of divisions from the command line
-    if (!((argc == 1) || (argc == 3))) {
-        std::cerr << "Invalid syntax: smallpt_thread_pool <width_divisions> <height_divisions>" << std::endl;
+    if (!(positional.empty() || (positional.size() == 2))) {
+        std::cerr << "Invalid syntax: smallpt_thread_pool [--stats[=<file.json>]] "
+            "[--frames=<camera_path>] [--denoise[=<radius>]] "
+            "[--layout=row|tiled|morton] [--tile=<size>] [--scene=cornell|balls] "
+            "<width_divisions> <height_divisions>" << std::endl;
         exit(1);
     }
 
-    size_t w_div = argc == 1 ? 2 : std::stol(argv[1]);
-    size_t h_div = argc == 1 ? 2 : std::stol(argv[2]);
+    if (positional.size() == 2) {
+        opt.w_div = std::stol(positional[0]);
+        opt.h_div = std::stol(positional[1]);
+    }
 
-    if (((w/w_div) < 4) || ((h/h_div) < 4)){
+    if (((w/opt.w_div) < 4) || ((h/opt.h_div) < 4)){
         std::cerr << "The minimum region width and height is 4" << std::endl;
         exit(1);
     }
-    return std::make_pair(w_div, h_div);
+
+    if ((opt.tile < 8) || (opt.tile & (opt.tile - 1))) {
+        std::cerr << "The tile size must be a power of two, 8 or larger" << std::endl;
+        exit(1);
+    }
+    return opt;
+}
+
+void print_stats(const RenderStats &st, double seconds)
+{
+    std::cout << "Rays traced: " << st.rays << " (" << st.camera_rays << " camera rays)" << std::endl;
+    std::cout << "Rays/sec: " << st.rays / seconds << std::endl;
+    std::cout << "Max depth: " << st.max_depth << std::endl;
+    std::cout << "Russian roulette terminations: " << st.rr_terminations << std::endl;
+    std::cout << "Path length histogram:" << std::endl;
+    for (int i = 0; i < RenderStats::histogram_size; ++i) {
+        if (st.path_depth[i]) {
+            std::cout << "  " << i << (i == RenderStats::histogram_size - 1 ? "+" : "")
+                << ": " << st.path_depth[i] << std::endl;
+        }
+    }
+}
+
+void write_stats_file(const std::string &file, const RenderStats &st,
+                      double seconds, const Options &opt, size_t w, size_t h, size_t samps)
+{
+    std::ofstream ofile(file, std::ios::out);
+    ofile << "{" << std::endl;
+    ofile << "  \"width\": " << w << "," << std::endl;
+    ofile << "  \"height\": " << h << "," << std::endl;
+    ofile << "  \"samples\": " << samps << "," << std::endl;
+    ofile << "  \"w_div\": " << opt.w_div << "," << std::endl;
+    ofile << "  \"h_div\": " << opt.h_div << "," << std::endl;
+    ofile << "  \"layout\": \"" << layout_name(opt.layout) << "\"," << std::endl;
+    ofile << "  \"tile\": " << opt.tile << "," << std::endl;
+    ofile << "  \"scene\": \"" << opt.scene << "\"," << std::endl;
+    ofile << "  \"threads\": " << std::thread::hardware_concurrency() << "," << std::endl;
+    ofile << "  \"seconds\": " << seconds << "," << std::endl;
+    ofile << "  \"rays\": " << st.rays << "," << std::endl;
+    ofile << "  \"camera_rays\": " << st.camera_rays << "," << std::endl;
+    ofile << "  \"rays_per_sec\": " << st.rays / seconds << "," << std::endl;
+    ofile << "  \"max_depth\": " << st.max_depth << "," << std::endl;
+    ofile << "  \"rr_terminations\": " << st.rr_terminations << "," << std::endl;
+    ofile << "  \"path_depth\": [";
+    for (int i = 0; i < RenderStats::histogram_size; ++i) {
+        ofile << (i ? ", " : "") << st.path_depth[i];
+    }
+    ofile << "]" << std::endl;
+    ofile << "}" << std::endl;
+}
+
+// Camera path for batch rendering: one camera per line as
+// "ox oy oz dx dy dz" (position and direction); '#' starts a comment line.
+std::vector<Ray> read_camera_path(const std::string &file)
+{
+    std::ifstream ifile(file);
+    if (!ifile) {
+        std::cerr << "Unable to open camera path " << file << std::endl;
+        exit(1);
+    }
+    std::vector<Ray> cams;
+    std::string line;
+    while (std::getline(ifile, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream iss(line);
+        Vec o, d;
+        if (!(iss >> o.x >> o.y >> o.z >> d.x >> d.y >> d.z)) {
+            std::cerr << "Invalid camera in " << file << ": " << line << std::endl;
+            exit(1);
+        }
+        cams.push_back(Ray(o, d.norm()));
+    }
+    if (cams.empty()) {
+        std::cerr << "The camera path " << file << " is empty" << std::endl;
+        exit(1);
+    }
+    return cams;
 }
 
-void write_output_file(const std::unique_ptr<Vec[]>& c, size_t w, size_t h)
+// Write the frame top to bottom; this is also the de-tiling pass for the
+// tiled and Morton layouts
+void write_output_file(const Vec *c, const frame_layout &layout, int w, int h,
+                       const std::string &file)
 {
-    std::ofstream ofile("image3.ppm", std::ios::out);
+    std::ofstream ofile(file, std::ios::out);
     ofile << "P3" << std::endl;
     ofile << w << " " << h << std::endl;
     ofile << "255" << std::endl;
-    for (size_t i=0; i<w*h; i++) {
-      ofile << toInt(c[i].x) << " " << toInt(c[i].y) << " " << toInt(c[i].z) << std::endl;
+    for (int y=h-1; y>=0; y--) {
+      for (int x=0; x<w; x++) {
+        const Vec &p = c[layout.index(x, y)];
+        ofile << toInt(p.x) << " " << toInt(p.y) << " " << toInt(p.z) << std::endl;
+      }
+    }
+}
+
+// Boundaries of div parts of [0, n), the last part takes the remainder.
+// Inner boundaries are rounded to multiples of unit, counted from n
+// downwards when flipped (image rows are stored top to bottom).
+std::vector<size_t> split_axis(size_t n, size_t div, size_t unit, bool flipped)
+{
+    std::vector<size_t> bounds(div + 1);
+    for (size_t k = 0; k <= div; ++k) {
+        size_t p = k == div ? n : k * (n / div);
+        if (k > 0 && k < div) {
+            size_t q = flipped ? n - p : p;
+            q = std::min(n, (q + unit / 2) / unit * unit);
+            p = flipped ? n - q : q;
+        }
+        bounds[k] = p;
+    }
+    return bounds;
+}
+
+// Split the image in w_div x h_div regions. With a tiled layout region
+// edges fall on tile edges so every tile is owned by a single task; regions
+// left empty by the rounding are dropped.
+std::vector<Region> make_regions(size_t w, size_t h, size_t w_div, size_t h_div,
+                                 const frame_layout &layout)
+{
+    const size_t unit = layout.granularity();
+    auto xs = split_axis(w, w_div, unit, false);
+    auto ys = split_axis(h, h_div, unit, true);
+
+    std::vector<Region> regions;
+    for (size_t i = 0; i < h_div; ++i) {
+        for (size_t j = 0; j < w_div; ++j) {
+            if (xs[j] < xs[j+1] && ys[i] < ys[i+1]) {
+                regions.push_back(Region(xs[j], xs[j+1], ys[i], ys[i+1]));
+            }
+        }
     }
+    return regions;
+}
+
+// Render one frame into c, one task per region, and wait for it. The pool
+// outlives the call so consecutive frames reuse the same workers.
+void render_frame(thread_pool &pool, const std::vector<Region> &regions,
+                  size_t w, size_t h, size_t samps, Ray cam, Vec *c,
+                  const frame_layout &layout,
+                  std::vector<RenderStats> &task_stats, AuxBuffers *aux)
+{
+    Vec cx=Vec(w*.5135/h), cy=(cx%cam.d).norm()*.5135;
+    for (size_t t = 0; t < regions.size(); ++t) {
+        Region reg = regions[t];
+        RenderStats *st = &task_stats[t];
+        pool.submit([=]{ render(w, h, samps, cam, cx, cy, c, layout, reg, st, aux); });
+    }
+    pool.wait_tasks();
+}
+
+// Denoise a rendered frame from c into out, one task per region
+void denoise_frame(thread_pool &pool, const std::vector<Region> &regions,
+                   size_t w, size_t h, const Vec *c, Vec *out,
+                   const frame_layout &layout,
+                   const AuxBuffers *aux, const DenoiseParams &prm)
+{
+    for (size_t t = 0; t < regions.size(); ++t) {
+        Region reg = regions[t];
+        pool.submit([=, &prm]{ denoise(w, h, c, out, aux, layout, reg, prm); });
+    }
+    pool.wait_tasks();
+}
+
+std::string frame_file_name(size_t frame)
+{
+    std::ostringstream oss;
+    oss << "frame_" << std::setw(4) << std::setfill('0') << frame << ".ppm";
+    return oss.str();
 }
 
 int main(int argc, char *argv[]){
     size_t w=1024, h=768, samps = 2; // # samples
 
-    Ray cam(Vec(50,52,295.6), Vec(0,-0.042612,-1).norm()); // cam pos, dir
-    Vec cx=Vec(w*.5135/h), cy=(cx%cam.d).norm()*.5135;
-    std::unique_ptr<Vec[]> c{new Vec[w*h]};
+    auto opt = usage(argc, argv, w, h);
+    bool batch = !opt.camera_path.empty();
 
-    auto p = usage(argc, argv, w, h);
-    auto w_div = p.first;
-    auto h_div = p.second;
+    if (opt.scene == "balls") {
+        build_balls_scene(scene);
+    } else {
+        build_cornell_scene(scene);
+    }
 
-    auto start = std::chrono::steady_clock::now();
+    std::vector<Ray> cams;
+    if (batch) {
+        cams = read_camera_path(opt.camera_path);
+    } else {
+        cams.push_back(Ray(Vec(50,52,295.6), Vec(0,-0.042612,-1).norm())); // cam pos, dir
+    }
 
-    auto *c_ptr = c.get(); // raw pointer to Vector c
+    // two framebuffers in batch mode: frame N is written to disk while
+    // frame N+1 is rendered into the other one
+    const size_t n_buffers = batch ? 2 : 1;
+    const frame_layout layout(opt.layout, w, h, opt.tile);
+    std::vector<aligned_array<Vec>> buffers;
+    std::vector<std::future<void>> pending_writes(n_buffers);
+    for (size_t b = 0; b < n_buffers; ++b) {
+        buffers.push_back(make_aligned<Vec>(layout.size()));
+    }
+
+    // the denoiser reads the noisy frame and writes a scratch buffer that is
+    // then swapped with the frame
+    std::unique_ptr<AuxBuffers> aux;
+    aligned_array<Vec> denoised;
+    if (opt.denoise) {
+        aux.reset(new AuxBuffers(layout.size()));
+        denoised = make_aligned<Vec>(layout.size());
+    }
+
+    auto regions = make_regions(w, h, opt.w_div, opt.h_div, layout);
+    // one statistics slot per task, each written once by its owner
+    std::vector<RenderStats> task_stats(regions.size());
+    RenderStats total;
 
-    // create a thread pool
-    //{ ==> scope usage
+    auto start = std::chrono::steady_clock::now();
+
+    // create the thread pool once for every frame
     thread_pool pool(std::thread::hardware_concurrency());
-    //thread_pool* pool = new thread_pool(std::thread::hardware_concurrency()); ==> dynamic memory usage
 
-    // launch the tasks
-    const auto y_height = h / h_div;
-    const auto x_width = w / w_div;
+    for (size_t f = 0; f < cams.size(); ++f) {
+        auto frame_start = std::chrono::steady_clock::now();
+        const size_t b = f % n_buffers;
+        Vec *c = buffers[b].get();
+        if (pending_writes[b].valid()) {
+            pending_writes[b].get(); // the buffer is still being written
+            std::fill(c, c + layout.size(), Vec());
+        }
 
-    int numTasks = 0;
-    for (size_t i = 0; i < h_div; ++i) {
-        for (size_t j = 0; j < w_div; ++j) {
-            size_t y0 = i * y_height;
-            size_t y1 = i == h_div -1 ? h : y0 + y_height;
+        render_frame(pool, regions, w, h, samps, cams[f], c, layout, task_stats, aux.get());
+        for (const auto &st : task_stats) {
+            total.merge(st);
+        }
 
-            size_t x0 = j * x_width;
-            size_t x1 = j == w_div -1 ? w : x0 + x_width;
+        if (opt.denoise) {
+            denoise_frame(pool, regions, w, h, c, denoised.get(), layout, aux.get(), opt.denoise_params);
+            buffers[b].swap(denoised);
+            c = buffers[b].get();
+        }
 
-            Region reg(x0, x1, y0, y1);
-            pool.submit([=]{ render(w, h, samps, cam, cx, cy, c_ptr, reg); });
-            //pool->submit([=]{ render(w, h, samps, cam, cx, cy, c_ptr, reg); }); ==> dynamic memory usage
-            numTasks++;
+        if (batch) {
+            auto frame_stop = std::chrono::steady_clock::now();
+            std::cout << "Frame " << f << ": " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(frame_stop-frame_start).count() << " ms." << std::endl;
+            pending_writes[b] = std::async(std::launch::async, write_output_file,
+                                           c, std::cref(layout), w, h, frame_file_name(f));
         }
-    //} ==> scope usage
     }
-    // wait for completion
-    pool.wait();
-    //delete pool; ==> dynamic memory usage
 
     auto stop = std::chrono::steady_clock::now();
     std::cout << "Execution time: " <<
       std::chrono::duration_cast<std::chrono::milliseconds>(stop-start).count() << " ms." << std::endl;
 
-    write_output_file(c, w, h);
+    if (opt.stats) {
+        double seconds = std::chrono::duration<double>(stop-start).count();
+        print_stats(total, seconds);
+        write_stats_file(opt.stats_file, total, seconds, opt, w, h, samps);
+    }
+
+    if (batch) {
+        for (auto &pw : pending_writes) {
+            if (pw.valid()) {
+                pw.get();
+            }
+        }
+    } else {
+        write_output_file(buffers[0].get(), layout, w, h, "image3.ppm");
+    }
 }
@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////
+//File: filters_environ.cc
+//
+//Description: OpenCL image filters (kernel_filters.cl) checked against
+//             the CImg functions they mirror
+//
+////////////////////////////////////////////////////////////////////
+#define cimg_use_jpeg
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "CImg.h"
+#include "cl_runtime.hpp"
+#include "cl_filters.hpp"
+
+
+using namespace cimg_library;
+
+// ################################ COMPARE ONE FILTER ################################
+int failures = 0;
+
+// runs the CImg version, prints how far the OpenCL result is from it and
+// both times; tolerance is relative to the largest CImg value
+void check(const char* name, cl_filters& filters, const CImg<float>& opencl, std::function<CImg<float>()> cimg,
+           float tolerance)
+{
+  double kernel_seconds = filters.seconds();
+  auto start = std::chrono::steady_clock::now();
+  CImg<float> expected = cimg();
+  double cimg_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  float error = 0;
+  if (!opencl.is_sameXYZC(expected)) {
+    error = INFINITY;
+  } else {
+    cimg_foroff(expected, i) {
+      error = std::max(error, std::fabs(opencl[i] - expected[i]));
+    }
+  }
+  float scale = std::max(1.0f, expected.is_empty() ? 0.0f : expected.get_abs().max());
+  bool pass = error <= tolerance * scale;
+  failures += !pass;
+  printf("%-24s %dx%dx%d  max error %g  %s  kernel %f s, CImg %f s\n", name, opencl.width(), opencl.height(),
+         opencl.spectrum(), error, pass ? "PASS" : "FAIL", kernel_seconds, cimg_seconds);
+}
+
+int main(int argc, char** argv)
+{
+  // 1. A CPU device by default, the references are computed on the CPU too
+  std::vector<cl_device_desc> devices = cl_discover_devices();
+  cl_print_devices(devices);
+  cl_device_desc device;
+  if (argc > 2) {
+    device = cl_find_device(devices, atoi(argv[1]), atoi(argv[2]));
+  } else {
+    std::vector<cl_device_desc> cpus = cl_discover_devices(CL_DEVICE_TYPE_CPU);
+    device = cpus.empty() ? cl_find_device(devices, 0, 0) : cpus[0];
+  }
+  printf("Device: %s\n\n", device.name.c_str());
+  cl_runtime runtime(std::vector<cl_device_desc>(1, device));
+
+  // ################################ LOAD AND BUILD KERNELS ################################
+  cl_filters filters(runtime, "kernel_filters.cl");
+  cl_build_info build_info = runtime.last_build();
+  printf("Program load time: %f seconds (%s)\n\n", build_info.seconds,
+         build_info.from_binary ? "warm: cached binary" : "cold: built from source");
+
+  // ################################ GET IMAGE ################################
+  CImg<float> img("image.jpg");
+  cl_image input = filters.upload(img);
+
+  // ################################ FILTERS ################################
+  CImg<float> sharpen(3, 3, 1, 1, 0, -1, 0, -1, 5, -1, 0, -1, 0);
+  check("convolve 3x3", filters, filters.download(filters.convolve(input, sharpen)),
+        [&] { return img.get_convolve(sharpen); }, 1e-5f);
+
+  CImg<float> box(9, 9, 1, 1, 1.0f / 81);
+  check("convolve 9x9", filters, filters.download(filters.convolve(input, box)),
+        [&] { return img.get_convolve(box); }, 1e-5f);
+
+  const float sigma = 2.5f;
+  const int radius = (int)ceil(3 * sigma);
+  CImg<float> gauss(2 * radius + 1);
+  cimg_forX(gauss, i) {
+    gauss[i] = expf(-0.5f * (i - radius) * (i - radius) / (sigma * sigma));
+  }
+  gauss /= gauss.sum();
+  check("gaussian 2.5", filters, filters.download(filters.gaussian(input, sigma)),
+        [&] { return img.get_convolve(gauss).convolve(gauss.get_transpose()); }, 1e-5f);
+
+  CImg<float> blurred = filters.download(filters.blur(input, sigma));
+  check("blur (Deriche) 2.5", filters, blurred, [&] { return img.get_blur(sigma, 1, false); }, 1e-4f);
+  blurred.cut(0, 255).save("blurred.jpg");
+
+  check("resize linear x1.5", filters,
+        filters.download(filters.resize(input, img.width() * 3 / 2, img.height() * 3 / 2)),
+        [&] { return img.get_resize(img.width() * 3 / 2, img.height() * 3 / 2, -100, -100, 3); }, 1e-4f);
+  check("resize cubic x1.5", filters,
+        filters.download(filters.resize(input, img.width() * 3 / 2, img.height() * 3 / 2, cl_interpolation::cubic)),
+        [&] { return img.get_resize(img.width() * 3 / 2, img.height() * 3 / 2, -100, -100, 5); }, 1e-4f);
+
+  for (float angle : { 90.0f, 30.0f }) {
+    std::string name = "rotate " + std::to_string((int)angle);
+    check(name.c_str(), filters, filters.download(filters.rotate(input, angle)),
+          [&] { return img.get_rotate(angle); }, 1e-4f);
+  }
+
+  std::vector<uint32_t> histogram = filters.histogram(input, 256, 0, 255);
+  check("histogram 256", filters, CImg<float>(histogram.data(), histogram.size()),
+        [&] { return CImg<float>(img.get_histogram(256, 0.0f, 255.0f)); }, 0);
+
+  printf("\n%s\n", failures ? "SOME FILTERS DIFFER FROM CIMG" : "All filters match CImg");
+  return failures ? -1 : 0;
+}
+//g++ filters_environ.cc -o filters_environ -I "CImg-2" -I ../include -lm -lpthread -lX11 -ljpeg -lOpenCL -std=c++11
+//./filters_environ                 first CPU device (e.g. pocl), or device 0 of platform 0
+//./filters_environ <platform> <device>
@@ -19,276 +19,22 @@
 #include <thread>
 #include <vector>
 #include "CImg.h"
-#ifdef __APPLE__
-  #include <OpenCL/opencl.h>
-#else
-  #define CL_TARGET_OPENCL_VERSION 220
-  #include <CL/cl.h>
-#endif
+#include "cl_runtime.hpp"
+#include "cl_host_memory.hpp"
+#include "cl_autotune.hpp"
+#include "cl_executor.hpp"
+#include "cl_pipeline.hpp"
+#include "parallel_reduce.hpp"
 
 
 using namespace cimg_library;
 
-enum {
-  HALF_APPROACH,
-  CHUNK_APPROACH
-};
-
-typedef struct {
-    unsigned char x;
-    unsigned char y;
-    unsigned char z;
-} uchar3;
-
-struct full_device_context {
-  cl_context context; 
-  cl_command_queue command_queue; 
-  cl_program program; 
-  cl_kernel kernel; 
-  size_t global_size; 
-  size_t local_size; 
-};
-
-  
-// check error, in such a case, it exits
-// g++ basic_environ.c -o basic -lOpenCL
-
-void cl_error(cl_int code, const char *string){
-	if (code != CL_SUCCESS){
-		printf("%d - %s\n", code, string);
-	    exit(-1);
-	}
-}
 ////////////////////////////////////////////////////////////////////////////////
 
-void initArray(unsigned char *array, CImg<unsigned char> img) {
-    for (int y = 0; y < img.height(); y++) {
-        for (int x = 0; x < img.width(); x++) {
-              array[(y * img.width() + x) * 3] = img(x, y, 0, 0);
-              array[(y * img.width() + x) * 3 + 1] = img(x, y, 0, 1);
-              array[(y * img.width() + x) * 3 + 2] = img(x, y, 0, 2);
-        }
-    }
-}
-
-void convertImage(unsigned char *array, CImg<unsigned char> &img) {
-    for (int y = 0; y < img.height(); y++) {
-        for (int x = 0; x < img.width(); x++) {
-               img(x, y, 0, 0) = array[(y * img.width() + x) * 3];
-               img(x, y, 0, 1) = array[(y * img.width() + x) * 3 + 1];
-               img(x, y, 0, 2) = array[(y * img.width() + x) * 3 + 2];
-        }
-    }
-}
-
-// ################################  WORKLOAD BALANCE APPROACHES (FUNCTIONS) ################################ 
-
-void half(int N_images, int& N_images_gpu1, int& N_images_gpu2) {
-  N_images_gpu1 = N_images / 2;
-  N_images_gpu2 = N_images - N_images_gpu1;
-}
-
-void divideInChunks(int N_images, int& N_images_gpu1, int& N_images_gpu2, float time_one_chunk_gpu1, float time_one_chunk_gpu2) {
-  if (time_one_chunk_gpu1 > time_one_chunk_gpu2) { // gpu2 is faster, more images to it
-    int gpu2_chunk_size = time_one_chunk_gpu1 / time_one_chunk_gpu2; // this will give a value bigger than one, meaning more images per chunk
-    std::cout << "gpu2 is " << gpu2_chunk_size << " times faster (rounded to int)" << std::endl;
-    N_images_gpu1 = N_images / (gpu2_chunk_size + 1);
-    N_images_gpu2 = N_images - N_images_gpu1;
-  } else if (time_one_chunk_gpu2 > time_one_chunk_gpu1) { // gpu1 is faster, more images to it
-    int gpu1_chunk_size = time_one_chunk_gpu2 / time_one_chunk_gpu1; // this will give a value bigger than one, meaning more images per chunk
-    std::cout << "gpu1 is " << gpu1_chunk_size << " times faster (rounded to int)" << std::endl;
-    N_images_gpu2 = N_images / (gpu1_chunk_size + 1);
-    N_images_gpu1 = N_images - N_images_gpu2;
-  } else { // equals, then go half
-    half(N_images, N_images_gpu1, N_images_gpu2);
-  }
-}
-
-float timeOneChunk(full_device_context device_context, CImg<unsigned char> img) {
-  // ################################  CREATE INPUT AND OUTPUT ARRAYS HOST MEMORY  ################################ 
-  unsigned char image_data[img.size()];
-  initArray(image_data, img);
-  if (image_data == NULL) {
-      perror("Failed to allocate memory for image_data");
-      exit(EXIT_FAILURE);
-  }
-  int err;
-  cl_mem img_buffer;
-  img_buffer = clCreateBuffer(device_context.context, CL_MEM_READ_WRITE, sizeof(unsigned char) * img.size(), NULL, &err);
-  cl_error(err, "Failed to create memory buffer at device\n");
-
-    // ################################ COPY DATA FROM HOST TO DEV  ################################
-  // Measurement of bandwidth from mem to kernel bandwidth = bytes passed / time spent passing them ==> B/s
-  
-  // Write data into the memory object
-  err = clEnqueueWriteBuffer(device_context.command_queue, img_buffer, CL_TRUE, 0, sizeof(unsigned char) * img.size(), image_data, 0, NULL, NULL);
-  cl_error(err, "Failed to enqueue a write command\n");
-    
-
-  // ################################ PASS ARGUMENTS  ################################
-  unsigned int width = img.width();
-  unsigned int height = img.height();
-
-  // Set the arguments to the kernel
-  err = clSetKernelArg(device_context.kernel, 0, sizeof(img_buffer), &img_buffer);
-  cl_error(err, "Failed to set argument 0\n");
-  err = clSetKernelArg(device_context.kernel, 1, sizeof(unsigned int), &width);
-  cl_error(err, "Failed to set argument 1\n");
-  err = clSetKernelArg(device_context.kernel, 2, sizeof(unsigned int), &height);
-  cl_error(err, "Failed to set argument 2\n");
-  
-  // ################################ LAUNCH KERNEL FUNCTION ################################ 
-  // Launch Kernel
-  cl_event event;
-  unsigned long start_kernel_time, end_kernel_time;
-  err = clEnqueueNDRangeKernel(device_context.command_queue, device_context.kernel, 1, NULL, &device_context.global_size, NULL, 0, NULL, &event);
-  cl_error(err, "Failed to launch kernel to the device\n");
-  
-  clWaitForEvents(1, &event);
-  // Obtainint profiling times
-  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start_kernel_time, NULL);
-  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end_kernel_time, NULL);
-
-  unsigned long elapsed_time_kernel = end_kernel_time - start_kernel_time;
-  float elapsed_time_kernel_seconds = (float)elapsed_time_kernel * 1e-9;
-
-  // ################################ READ IMAGE (AUTOMATICALLY REPLACED) ################################ 
-  //enqueue the order to read results form device memory
-  err = clEnqueueReadBuffer(device_context.command_queue, img_buffer, CL_TRUE, 0, sizeof(unsigned char) * img.size(), image_data, 0, NULL, NULL);
-  cl_error(err, "Failed to enqueue a read command\n");
-  
-  // ################################ FREE MEM ################################ 
-  clReleaseMemObject(img_buffer);
-  return elapsed_time_kernel_seconds;
-}
-
-// ################################  PARALLEL KERNEL RUNNING ################################ 
-void runKernel(int N_images, cl_context context, cl_command_queue command_queue, cl_program program, cl_kernel kernel, 
-            size_t global_size, size_t local_size, int& err, CImg<unsigned char> img, bool isGPU1) {
-  auto start = std::chrono::steady_clock::now();
-  float communication_time = 0, computation_time = 0;
-  
-
-  // ################################  CREATE INPUT AND OUTPUT ARRAYS HOST MEMORY  ################################ 
-  unsigned char image_data[img.size()];
-  initArray(image_data, img);
-  if (image_data == NULL) {
-      perror("Failed to allocate memory for image_data");
-      exit(EXIT_FAILURE);
-  }
-
-  cl_event event_to_kernel[N_images];
-  cl_mem img_buffers[N_images];
-  for (int i = 0; i < N_images; ++i) {
-    img_buffers[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(unsigned char) * img.size(), NULL, &err);
-    cl_error(err, "Failed to create memory buffer at device\n");
-
-      // ################################ COPY DATA FROM HOST TO DEV  ################################
-    // Measurement of bandwidth from mem to kernel bandwidth = bytes passed / time spent passing them ==> B/s
-    
-    // Write data into the memory object
-    err = clEnqueueWriteBuffer(command_queue, img_buffers[i], CL_TRUE, 0, sizeof(unsigned char) * img.size(), image_data, 0, NULL, &event_to_kernel[i]);
-    cl_error(err, "Failed to enqueue a write command\n");
-    
-  }
-  unsigned long start_to_kernel, end_to_kernel, transfer_time_to_kernel = 0;
-  for (int i = 0; i < N_images; ++i) {
-    clWaitForEvents(1, &event_to_kernel[i]);
-
-    // Obtaining profiling times
-    clGetEventProfilingInfo(event_to_kernel[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start_to_kernel, NULL);
-    clGetEventProfilingInfo(event_to_kernel[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end_to_kernel, NULL);
-
-    transfer_time_to_kernel += end_to_kernel - start_to_kernel;
-  }
-
-  float transfer_time_to_kernel_seconds = (float)transfer_time_to_kernel * 1e-9; 
-  communication_time += transfer_time_to_kernel_seconds;
-
-
-  // ################################ PASS ARGUMENTS  ################################
-  cl_event event_kernel[N_images];
-  unsigned int width = img.width();
-  unsigned int height = img.height();
-  for (int i = 0; i < N_images; ++i) {
-    // Set the arguments to the kernel
-    err = clSetKernelArg(kernel, 0, sizeof(img_buffers[i]), &img_buffers[i]);
-    cl_error(err, "Failed to set argument 0\n");
-    err = clSetKernelArg(kernel, 1, sizeof(unsigned int), &width);
-    cl_error(err, "Failed to set argument 1\n");
-    err = clSetKernelArg(kernel, 2, sizeof(unsigned int), &height);
-    cl_error(err, "Failed to set argument 2\n");
-    
-    // ################################ LAUNCH KERNEL FUNCTION ################################ 
-    // Launch Kernel
-    err = clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, &event_kernel[i]);
-    cl_error(err, "Failed to launch kernel to the device\n");
-  }
-
-  unsigned long start_kernel, end_kernel, time_kernel = 0;
-  for (int i = 0; i < N_images; ++i) {
-    clWaitForEvents(1, &event_kernel[i]);
-
-    // Obtaining profiling times
-    clGetEventProfilingInfo(event_kernel[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start_kernel, NULL);
-    clGetEventProfilingInfo(event_kernel[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end_kernel, NULL);
-
-    time_kernel += end_kernel - start_kernel;
-  }
-
-  float time_kernel_seconds = (float)time_kernel * 1e-9; 
-  computation_time += time_kernel_seconds;
-  
-
-  // ################################ READ IMAGE (AUTOMATICALLY REPLACED) ################################ 
-  cl_event event_from_kernel[N_images];
-  for (int i = 0; i < N_images; ++i) {
-    //enqueue the order to read results form device memory
-    err = clEnqueueReadBuffer(command_queue, img_buffers[i], CL_TRUE, 0, sizeof(unsigned char) * img.size(), image_data, 0, NULL, &event_from_kernel[i]);
-    cl_error(err, "Failed to enqueue a read command\n");
-
-    if (i == 0 || i == N_images - 1) {
-      char file_name[50];  
-      if (isGPU1) sprintf(file_name, "gpu1_flipped%d.jpg", i);
-      else sprintf(file_name, "gpu2_flipped%d.jpg", i);
-      
-      convertImage(image_data, img);
-      img.save(file_name);
-    }
-  }
-
-  unsigned long start_from_kernel, end_from_kernel, transfer_time_from_kernel = 0;
-  for (int i = 0; i < N_images; ++i) {
-    clWaitForEvents(1, &event_from_kernel[i]);
-
-    // Obtaining profiling times
-    clGetEventProfilingInfo(event_from_kernel[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start_from_kernel, NULL);
-    clGetEventProfilingInfo(event_from_kernel[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end_from_kernel, NULL);
-
-    transfer_time_from_kernel += end_from_kernel - start_from_kernel;
-  }
-
-  float transfer_time_from_kernel_seconds = (float)transfer_time_from_kernel * 1e-9; 
-  communication_time += transfer_time_from_kernel_seconds;
-  
-  
-  // ################################ FREE MEM ################################ 
-  for (int i = 0; i < N_images; ++i) clReleaseMemObject(img_buffers[i]);
-  auto end = std::chrono::steady_clock::now();
-  auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-  std::string device = isGPU1 ? "GPU1" : "GPU2";
-  float exec_time = elapsed_time.count() / 1000.0f;
-
-  std::cout << "Ended" << device << ", execution time: " << exec_time << "s" << std::endl;
-  std::cout << "Ended" << device << ", communication time: " << communication_time << "s" << std::endl;
-  std::cout << "Ended" << device << ", computation time: " << computation_time << "s" << std::endl;
-
-}
-
 int main(int argc, char** argv)
 {
-  if (argc < 7){ // 1 for adding second gpu 0 for not adding it
-    std::cout << "Usage: " << argv[0] << " <platform> <gpu1_device> <gpu2_device> <add_second_gpu> <N_images> <balance_approach>" << std::endl;
+  if (argc < 6){ // 1 for adding second gpu 0 for not adding it
+    std::cout << "Usage: " << argv[0] << " <platform> <gpu1_device> <gpu2_device> <add_second_gpu> <N_images> [pipeline_depth] [sub_devices] [host_threads]" << std::endl;
     return 1;
   }
 
@@ -297,232 +43,116 @@ int main(int argc, char** argv)
   int gpu2_device = std::stoi(argv[3]);
   bool add_gpu = std::stoi(argv[4]) == 1 ? true : false;
   int N_images = std::stoi(argv[5]);
-  int balance_approach = std::stoi(argv[6]) == 0 ? HALF_APPROACH : CHUNK_APPROACH; 
-
-  const unsigned int N = 100;
-  int err;                            	// error code returned from api calls
-  int gpu1_err;                            	// error code returned from api calls
-  int gpu2_err;                            	// error code returned from api calls
-  size_t t_buf = 50;			// size of str_buffer
-  char str_buffer[t_buf];		// auxiliary buffer	
-  size_t e_buf;				// effective size of str_buffer in use
-	    
-  size_t gpu2_global_size;                      	// global domain size for our calculation
-  size_t gpu2_local_size;                       	// local domain size for our calculation
-
-  size_t gpu1_global_size;                      	// global domain size for our calculation
-  size_t gpu1_local_size;                       	// local domain size for our calculation
-
-  const cl_uint num_platforms_ids = 10;				// max of allocatable platforms
-  cl_platform_id platforms_ids[num_platforms_ids];		// array of platforms
-  cl_uint n_platforms;						// effective number of platforms in use
-  const cl_uint num_devices_ids = 10;				// max of allocatable devices
-  cl_device_id devices_ids[num_platforms_ids][num_devices_ids];	// array of devices
-  cl_uint n_devices[num_platforms_ids];				// effective number of devices in use for each platform
-	
-  cl_context context;                 				// compute context
-  cl_program program;                         // compute program
-  cl_kernel kernel;                           // compute kernel
-
-  cl_device_id gpu2_device_id;             				// compute device id 
-  cl_command_queue gpu2_command_queue;     				// compute command queue
+  size_t pipeline_depth = argc > 6 ? std::stoi(argv[6]) : 3; // device buffers per device, 2 double and 3 triple buffering
+  cl_uint sub_devices = argc > 7 ? std::stoi(argv[7]) : 1;   // > 1 splits every device (e.g. the CPU) in sub-devices
+  size_t host_threads = argc > 8 ? std::stoi(argv[8]) : 0;   // > 0 adds the host with a pool of that many threads
 
+  // 1. Scan the available platforms and devices
+  std::vector<cl_device_desc> devices = cl_discover_devices();
+  printf("Number of available devices: %zu\n\n", devices.size());
+  cl_print_devices(devices);
 
-  cl_device_id gpu1_device_id;             				// compute device id 
-  cl_command_queue gpu1_command_queue;     				// compute command queue
-
-  // ################################ OVERALL TIME ################################ 
-  clock_t start_time, end_time;
-  float gpu2_time;
-  start_time = clock();
-
-  // ################################ KERNEL TIME ################################ 
-  cl_event events[1];
-  unsigned long start_kernel_time, end_kernel_time;
-    
-
-  // 1. Scan the available platforms:
-  err = clGetPlatformIDs (num_platforms_ids, platforms_ids, &n_platforms);
-  cl_error(err, "Error: Failed to Scan for Platforms IDs");
-  printf("Number of available platforms: %d\n\n", n_platforms);
-
-  for (int i = 0; i < n_platforms; i++ ){
-    err= clGetPlatformInfo(platforms_ids[i], CL_PLATFORM_NAME, t_buf, str_buffer, &e_buf);
-    cl_error (err, "Error: Failed to get info of the platform\n");
-    printf( "\t[%d]-Platform Name: %s\n", i, str_buffer);
-  }
-  printf("\n");
-  // ***Task***: print on the screen the name, host_timer_resolution, vendor, versionm, ...
-	
-  // 2. Scan for devices in each platform
-  for (int i = 0; i < n_platforms; i++ ){
-    err = clGetDeviceIDs(platforms_ids[i], CL_DEVICE_TYPE_ALL, num_devices_ids, devices_ids[i], &(n_devices[i]));
-    cl_error(err, "Error: Failed to Scan for Devices IDs");
-    printf("\t[%d]-Platform. Number of available devices: %d\n", i, n_devices[i]);
-
-    for(int j = 0; j < n_devices[i]; j++){
-      err = clGetDeviceInfo(devices_ids[i][j], CL_DEVICE_NAME, sizeof(str_buffer), str_buffer, NULL);
-      cl_error(err, "clGetDeviceInfo: Getting device name");
-      printf("\t\t [%d]-Platform [%d]-Device CL_DEVICE_NAME: %s\n", i, j,str_buffer);
-
-      cl_uint max_compute_units_available;
-      err = clGetDeviceInfo(devices_ids[i][j], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(max_compute_units_available), &max_compute_units_available, NULL);
-      cl_error(err, "clGetDeviceInfo: Getting device max compute units available");
-      printf("\t\t [%d]-Platform [%d]-Device CL_DEVICE_MAX_COMPUTE_UNITS: %d\n\n", i, j, max_compute_units_available);
-    }
-  }	
-  // ***Task***: print on the screen the cache size, global mem size, local memsize, max work group size, profiling timer resolution and ... of each device
-
-
-  // 3. Create a context
-  cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)platforms_ids[platform], 0};
-  context = clCreateContext(properties, n_devices[platform], devices_ids[platform], NULL, NULL, &err);
-  cl_error(err, "Failed to create a compute context\n");
-
-  // 4. Create a command queue for both devices
-  cl_command_queue_properties gpu1_proprt[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
-  gpu1_command_queue = clCreateCommandQueueWithProperties(context, devices_ids[platform][gpu1_device], gpu1_proprt, &err);
-  cl_error(err, "Failed to create a command queue\n");
-
+  // 2. Create a context over the selected devices or their sub-devices
+  std::vector<cl_device_desc> selected(1, cl_find_device(devices, platform, gpu1_device));
   if (add_gpu){
-    // 4. Create a command queue
-    cl_command_queue_properties gpu2_proprt[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
-    gpu2_command_queue = clCreateCommandQueueWithProperties(context, devices_ids[platform][gpu2_device], gpu2_proprt, &err);
-    cl_error(err, "Failed to create a command queue\n");
+    selected.push_back(cl_find_device(devices, platform, gpu2_device));
+  }
+  if (sub_devices > 1) {
+    std::vector<cl_device_desc> parts;
+    for (const auto& d : selected) {
+      for (const auto& sub : cl_partition_equally(d, sub_devices)) {
+        parts.push_back(sub);
+      }
+    }
+    selected = parts;
   }
+  cl_runtime runtime(selected);
 
   // ################################ GET IMAGE ################################ 
   CImg<unsigned char> img("image.jpg");
-  CImg<unsigned char> img_1("image1.jpg");
   std::cout << "Image size: " << sizeof(unsigned char) * img.size() << "B" << std::endl;
   
-  // ################################ LOAD KERNEL ################################ 
-  // Calculate size of the file
-  FILE *fileHandler = fopen("kernel_flip.cl", "r");
-  if (fileHandler == NULL) {
-    printf("Unable to open file\n");
-    return 1;
-  }
-  fseek(fileHandler, 0, SEEK_END);
-  size_t fileSize = ftell(fileHandler);
-  rewind(fileHandler);
+  // ################################ LOAD AND BUILD KERNEL ################################ 
+  cl_program program = runtime.program("kernel_flip.cl");
+  cl_build_info build_info = runtime.last_build();
+  printf("Program load time: %f seconds (%s)\n", build_info.seconds,
+         build_info.from_binary ? "warm: cached binary" : "cold: built from source");
 
-  // read kernel source into buffer
-  char * sourceCode = (char*) malloc(fileSize + 1);
-  sourceCode[fileSize] = '\0';
-  fread(sourceCode, sizeof(char), fileSize, fileHandler);
-  fclose(fileHandler);
-
-  // create program from buffer 
-  const char* constSourceCode = (const char*)sourceCode;
-  program = clCreateProgramWithSource(context, 1, &constSourceCode, NULL, &err);
-  cl_error(err, "Failed to create program with source\n");
-  free(sourceCode);
-  
-
-  // ################################ BUILD KERNEL ################################ 
-  // Build the executable and check errors
-  err = clBuildProgram(program, 2, devices_ids[platform], NULL, NULL, NULL);
-  if (err != CL_SUCCESS){
-    size_t len;
-    char buffer[2048];
-
-    printf("Error: Some error at building process.\n");
-    // first call to determine the size of the build log
-    clGetProgramBuildInfo(program, devices_ids[platform][gpu1_device], CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-    buffer[len] = '\0';
-    // second call to retrieve the actual log data
-    clGetProgramBuildInfo(program, devices_ids[platform][gpu1_device], CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
-    printf("%s\n", buffer);
-    exit(-1);
-  }
-
-  // ################################  CREATE KERNEL ################################ 
-  // Create a compute kernel with the program we want to run
-  kernel = clCreateKernel(program, "image_flip", &err);
-  cl_error(err, "Failed to create kernel from the program\n");
-
-  
-
-  // ################################  WORKLOAD BALANCE APPROACHES  ################################ 
-  int N_images_gpu1 = N_images;
-  int N_images_gpu2 = 0;
-  full_device_context gpu2_context_struct;
-  full_device_context gpu1_context_struct;
-  float time_one_chunk_gpu1 = 0;
-  float time_one_chunk_gpu2 = 0;
-  gpu1_global_size = (size_t)(img.size() / 3);
-  gpu1_local_size = NULL;
-  gpu2_global_size = (size_t)(img.size() / 3);
-  gpu2_local_size = NULL;
-  if (add_gpu){
-    switch (balance_approach)
-    {
-    case HALF_APPROACH:
-      std::cout << "Approach selected: HALF_APPROACH" << std::endl;
-      half(N_images, N_images_gpu1, N_images_gpu2);
-      break;
-    case CHUNK_APPROACH:
-      std::cout << "Approach selected: CHUNK_APPROACH" << std::endl;
-      gpu1_context_struct.command_queue = gpu1_command_queue;
-      gpu1_context_struct.context = context;
-      gpu1_context_struct.global_size = gpu1_global_size;
-      gpu1_context_struct.local_size = gpu1_local_size;
-      gpu1_context_struct.program = program;
-      gpu1_context_struct.kernel = kernel;
-      time_one_chunk_gpu1 = timeOneChunk(gpu1_context_struct, img);
-      std::cout << "Time one chunk gpu1: " << time_one_chunk_gpu1 << std::endl;
+  // ################################ TUNE THE WORK-GROUP SHAPES ################################ 
+  // every device gets the fastest shape for it (cached with the binaries)
+  unsigned int width = img.width();
+  unsigned int height = img.height();
+  unsigned int planes = img.spectrum();
+  unsigned int rows = height * planes;
+  size_t global_size[2] = { width / 2 / 16 + 1, rows };
+  cl_executor executor(runtime, program, "image_flip_2d", pipeline_depth);
+  for (size_t d = 0; d < runtime.size(); ++d) {
+    cl_kernel_ref kernel = runtime.kernel(program, "image_flip_2d");
+    cl_buffer scratch = runtime.buffer(CL_MEM_READ_WRITE, img.size());
+    cl_set_args(kernel.get(), scratch, width, rows);
+    cl_tuning tuning = cl_autotune(runtime, d, kernel.get(), "image_flip_2d", 2, global_size);
+    executor.set_tuning(d, tuning);
+    std::cout << "Device " << d << " (" << runtime.device(d).name << "), work-group shape: " << tuning.name()
+              << (tuning.from_cache ? " (cached)" : " (tuned)") << std::endl;
+  }
+
+  // ################################ GO PARALLEL NOW ################################ 
+  // Every device pulls images from an adaptive balancer when it has a free
+  // buffer, with its own kernel object and queues (cl_executor.hpp); the
+  // host can flip images too, splitting their rows over host_threads
+  auto start = std::chrono::steady_clock::now();
+  auto store = [&](size_t i, unsigned char* host) {
+    if (i == 0 || i == (size_t)N_images - 1) {
+      char file_name[50];  
+      sprintf(file_name, "flipped%zu.jpg", i);
+      CImg<unsigned char>(host, width, height, 1, planes, true).save(file_name);
+    }
+  };
+  reduce_options host_pool;
+  host_pool.threads = std::max<size_t>(1, host_threads);
+  std::vector<cl_executor_report> reports = executor.run(N_images, sizeof(unsigned char) * img.size(),
+      2, global_size, NULL,
+      [&](size_t, unsigned char* host) {
+        // decoded straight into the transfer buffer
+        CImg<unsigned char>(host, width, height, 1, planes, true).load("image.jpg");
+      },
+      [&](cl_kernel kernel, cl_mem buffer) {
+        cl_set_args(kernel, buffer, width, rows);
+      },
+      store,
+      [&](size_t i) {
+        CImg<unsigned char> flipped(img);
+        parallel_for(0, (size_t)height * planes, [&](size_t b, size_t e) {
+            for (size_t row = b; row < e; ++row) {
+              std::reverse(flipped.data() + row * width, flipped.data() + (row + 1) * width);
+            }
+        }, host_pool);
+        store(i, flipped.data());
+      },
+      host_threads > 0);
+  auto end = std::chrono::steady_clock::now();
 
-      gpu2_context_struct.command_queue = gpu2_command_queue;
-      gpu2_context_struct.context = context;
-      gpu2_context_struct.global_size = gpu2_global_size;
-      gpu2_context_struct.local_size = gpu2_local_size;
-      gpu2_context_struct.program = program;
-      gpu2_context_struct.kernel = kernel;
-      time_one_chunk_gpu2 = timeOneChunk(gpu2_context_struct, img);
-      std::cout << "Time one chunk gpu2: " << time_one_chunk_gpu2 << std::endl;
-      divideInChunks(N_images, N_images_gpu1, N_images_gpu2, time_one_chunk_gpu1, time_one_chunk_gpu2);
-      break;
-    default:
-      return 1;
-      break;
+  for (size_t d = 0; d < reports.size(); ++d) {
+    const cl_executor_report &r = reports[d];
+    std::string device = "device " + std::to_string(d) + " (" + r.name + ")";
+    std::cout << "Ended " << device << ", images: " << r.balance.items << " in " << r.balance.chunks
+              << " chunks, " << r.balance.stolen << " stolen" << std::endl;
+    std::cout << "Ended " << device << ", measured time per image: " << r.balance.seconds_per_item << "s" << std::endl;
+    if (r.name != "host") {
+      std::cout << "Ended " << device << ", execution time: " << r.stats.wall << "s" << std::endl;
+      std::cout << "Ended " << device << ", communication time: " << r.stats.upload + r.stats.download << "s" << std::endl;
+      std::cout << "Ended " << device << ", computation time: " << r.stats.compute << "s" << std::endl;
+      std::cout << "Ended " << device << ", transfers and compute overlapped: " << r.stats.overlap() * 100 << "%" << std::endl;
     }
   }
-  
-  
-  
-  // GO PARALLEL NOW
-  auto start = std::chrono::steady_clock::now();
-  std::cout << "Number of images for gpu1: " << N_images_gpu1 << std::endl;
-  std::cout << "Number of images for gpu2: " << N_images_gpu2 << std::endl;
-  std::vector<std::thread> thread_vector;
-  thread_vector.push_back(std::thread(runKernel, N_images_gpu1, context, gpu1_command_queue, program, kernel, 
-                          gpu1_global_size, gpu1_local_size, std::ref(gpu1_err), img, true));
-  if (add_gpu){
-  thread_vector.push_back(std::thread(runKernel, N_images_gpu2, context, gpu2_command_queue, program, kernel, 
-                          gpu2_global_size, gpu2_local_size, std::ref(gpu2_err), img, false));
-  }
 
-  for(size_t i = 0; i < thread_vector.size(); ++i) {
-      thread_vector[i].join();
-  }
-  auto end = std::chrono::steady_clock::now();
   auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
   float exec_time = elapsed_time.count() / 1000.0f;
   std::cout << "FINAL EXECUTION TIME: " << exec_time << "s" << std::endl;
 
-  clReleaseContext(context);
-
-  clReleaseProgram(program);
-  clReleaseKernel(kernel);
-  clReleaseCommandQueue(gpu1_command_queue);
-  
-
-  if (add_gpu){
-    clReleaseCommandQueue(gpu2_command_queue);
-  }
-
   return 0;
 }
-//g++ flip_environ_two_devices.cc -o flip_environ_two_devices -I "CImg-2" -lm -lpthread -lX11 -ljpeg -lOpenCL -std=c++11
-//./flip_environ_two_devices
+//g++ flip_environ_two_devices.cc -o flip_environ_two_devices -I "CImg-2" -I ../include -lm -lpthread -lX11 -ljpeg -lOpenCL -std=c++11
+//./flip_environ_two_devices 0 0 1 1 100          two devices of platform 0
+//./flip_environ_two_devices 0 0 0 0 100 3 4      the CPU split in 4 sub-devices
+//./flip_environ_two_devices 0 0 1 1 100 3 1 4    two devices and the host with 4 threads
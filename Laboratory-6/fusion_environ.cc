@@ -0,0 +1,103 @@
+////////////////////////////////////////////////////////////////////
+//File: fusion_environ.cc
+//
+//Description: flip, blur and grayscale of an image as one fused OpenCL
+//             kernel (cl_fusion.hpp) against one kernel per operation
+//
+////////////////////////////////////////////////////////////////////
+#define cimg_use_jpeg
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "CImg.h"
+#include "cl_runtime.hpp"
+#include "cl_filters.hpp"
+#include "cl_fusion.hpp"
+
+
+using namespace cimg_library;
+
+int main(int argc, char** argv)
+{
+  int N_images = argc > 1 ? atoi(argv[1]) : 10;
+
+  // 1. Scan the available platforms and devices
+  std::vector<cl_device_desc> devices = cl_discover_devices();
+  cl_print_devices(devices);
+
+  // 2. Create a context and a command queue with the selected device
+  size_t platform = argc > 3 ? atoi(argv[2]) : 0;
+  size_t device = argc > 3 ? atoi(argv[3]) : 0;
+  cl_runtime runtime(std::vector<cl_device_desc>(1, cl_find_device(devices, platform, device)));
+
+  // ################################ GET IMAGE ################################
+  CImg<float> img("image.jpg");
+  unsigned int width = img.width();
+  unsigned int height = img.height();
+
+  // ################################ BUILD THE PIPELINE ################################
+  // flip, 3x3 binomial blur, grayscale, back to 0..255
+  cl_fusion pipeline(img.spectrum());
+  pipeline.flip()
+      .convolve({ 1, 2, 1, 2, 4, 2, 1, 2, 1 }, 3, 3)
+      .scale(1.0f / 16)
+      .grayscale()
+      .map("clamp(v, 0.0f, 255.0f)");
+
+  cl_fused_kernel fused(runtime, pipeline);
+  printf("Fused program: %f seconds (%s)\n", fused.build().seconds,
+         fused.build().from_memory ? "in memory" :
+         fused.build().from_binary ? "warm: cached binary" : "cold: built from source");
+  // the same chain again is not built again
+  cl_fused_kernel again(runtime, pipeline);
+  printf("Same pipeline again: %s\n\n", again.build().from_memory ? "reused, not built" : "built again");
+
+  // ################################ RUN FUSED AND UNFUSED ################################
+  double fused_seconds = 0, unfused_seconds = 0;
+  float difference = 0;
+  CImg<float> result;
+  for (int i = 0; i < N_images; ++i) {
+    cl_image input = cl_make_image(runtime, width, height, img.spectrum());
+    input.buffer.write(runtime.queue(0), img.data(), true);
+
+    cl_image out = fused.run(input);
+    fused_seconds += fused.seconds();
+    result.assign(width, height, 1, out.planes);
+    out.buffer.read(runtime.queue(0), result.data(), true);
+
+    cl_image reference = fused.run_unfused(input);
+    unfused_seconds += fused.seconds();
+    CImg<float> unfused(width, height, 1, reference.planes);
+    reference.buffer.read(runtime.queue(0), unfused.data(), true);
+    difference = std::max(difference, (result - unfused).abs().max());
+  }
+  result.save("fused.jpg");
+
+  // ################################ COUNT GLOBAL MEMORY TRAFFIC ################################
+  // instrumented kernels count the loads and stores they issue; the
+  // compulsory traffic (every image read or written once) is the lower bound
+  cl_image input = cl_make_image(runtime, width, height, img.spectrum());
+  input.buffer.write(runtime.queue(0), img.data(), true);
+  cl_fusion_traffic counted = fused.count(input);
+  cl_fusion_traffic compulsory = pipeline.traffic(width, height);
+
+  // ################################ REPORT ################################
+  printf("Operations: %zu\n", pipeline.size());
+  for (size_t s = 0; s < pipeline.size(); ++s) {
+    printf("\t%s\n", pipeline.name(s).c_str());
+  }
+  printf("Global memory loads and stores per image, fused: %zu B counted, %zu B compulsory\n", counted.fused,
+         compulsory.fused);
+  printf("Global memory loads and stores per image, unfused: %zu B counted, %zu B compulsory\n", counted.unfused,
+         compulsory.unfused);
+  printf("Counted traffic saved by fusion: %.1f%% (negative: fusion issues more loads)\n", counted.saving() * 100);
+  printf("Kernel time per image, fused: %f seconds\n", fused_seconds / N_images);
+  printf("Kernel time per image, unfused: %f seconds\n", unfused_seconds / N_images);
+  printf("Largest difference fused / unfused: %g\n", difference);
+
+  return 0;
+}
+//g++ fusion_environ.cc -o fusion_environ -I "CImg-2" -I ../include -lm -lpthread -lX11 -ljpeg -lOpenCL -std=c++11
+//./fusion_environ [N_images] [platform device]
@@ -0,0 +1,287 @@
+// Image filters with the semantics of their CImg counterparts, on float
+// images in CImg's planar layout: `planes` planes of width * height values
+// (RRR...GGG...BBB...), so the host uploads CImg<float>::data() as it is.
+// Host side: include/cl_filters.hpp.
+
+
+// CImg::get_convolve(mask) with Neumann boundaries (the default):
+//   out(x, y) = sum_ij mask(i, j) * in(x - i + center_x, y - j + center_y)
+// with coordinates clamped to the image. Range: (width, height, planes)
+// rounded up to the work-group shape. Each work-group first copies the
+// input block it reads, its shape plus the mask size minus one, into
+// local memory (`tile`, (local_w + mask_width - 1) * (local_h +
+// mask_height - 1) floats), so every input value is read once from global
+// memory instead of mask_width * mask_height times.
+__kernel void convolve_tiled(
+  __global const float* in,
+  __global float* out,
+  __constant float* mask,
+  const unsigned int width,
+  const unsigned int height,
+  const unsigned int mask_width,
+  const unsigned int mask_height,
+  const int center_x,
+  const int center_y,
+  __local float* tile){
+
+  int lx = get_local_id(0);
+  int ly = get_local_id(1);
+  int group_w = get_local_size(0);
+  int group_h = get_local_size(1);
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  unsigned int plane = get_global_id(2);
+
+  int tile_w = group_w + mask_width - 1;
+  int tile_h = group_h + mask_height - 1;
+  int x0 = get_group_id(0) * group_w - (mask_width - 1 - center_x);
+  int y0 = get_group_id(1) * group_h - (mask_height - 1 - center_y);
+  __global const float* src = in + (size_t)plane * width * height;
+
+  // work-items out of the image help loading and must reach the barrier
+  for (int ty = ly; ty < tile_h; ty += group_h) {
+    int sy = clamp(y0 + ty, 0, (int)height - 1);
+    for (int tx = lx; tx < tile_w; tx += group_w) {
+      int sx = clamp(x0 + tx, 0, (int)width - 1);
+      tile[ty * tile_w + tx] = src[sy * width + sx];
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (x < (int)width && y < (int)height) {
+    float sum = 0;
+    for (unsigned int j = 0; j < mask_height; ++j) {
+      __local const float* line = tile + (ly + mask_height - 1 - j) * tile_w + lx + mask_width - 1;
+      for (unsigned int i = 0; i < mask_width; ++i) {
+        sum += mask[j * mask_width + i] * line[-(int)i];
+      }
+    }
+    out[(size_t)plane * width * height + y * width + x] = sum;
+  }
+}
+
+
+// One pass of CImg's recursive Deriche filter of order 0 (CImg::deriche,
+// used by get_blur(sigma, 1, false)) with Neumann boundaries: a causal and
+// an anti-causal second order recursion along every line. The recursion
+// is sequential, so each work-item runs a whole line; lines are rows
+// (along x) or columns (along y):
+//   line l = plane * lines_per_plane + k starts at
+//   plane * plane_size + k * line_step, its values are `step` apart.
+// Along y neighbouring work-items read neighbouring values, which
+// coalesces. c = (a0, a1, a2, a3, b1, b2, coefp, coefn), computed by the
+// host as CImg does. Range: lines.
+__kernel void deriche_lines(
+  __global const float* in,
+  __global float* out,
+  const unsigned int length,
+  const unsigned int step,
+  const unsigned int lines_per_plane,
+  const unsigned int line_step,
+  const unsigned int plane_size,
+  const unsigned int lines,
+  const float8 c){
+
+  unsigned int l = get_global_id(0);
+  if (l >= lines || length == 0) {
+    return;
+  }
+  size_t start = (size_t)(l / lines_per_plane) * plane_size + (size_t)(l % lines_per_plane) * line_step;
+
+  float xp = in[start];
+  float yp = c.s6 * xp;
+  float yb = yp;
+  for (unsigned int m = 0; m < length; ++m) {
+    size_t i = start + (size_t)m * step;
+    float xc = in[i];
+    float yc = c.s0 * xc + c.s1 * xp - c.s4 * yp - c.s5 * yb;
+    out[i] = yc;
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
+
+  float xn = in[start + (size_t)(length - 1) * step];
+  float xa = xn;
+  float yn = c.s7 * xn;
+  float ya = yn;
+  for (unsigned int n = length; n-- > 0;) {
+    size_t i = start + (size_t)n * step;
+    float xc = in[i];
+    float yc = c.s2 * xn + c.s3 * xa - c.s4 * yn - c.s5 * ya;
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
+    out[i] += yc;
+  }
+}
+
+
+// value at `pos` of a line of `length` values `step` apart, linear (cubic
+// == 0) or Catmull-Rom cubic, the interpolations of CImg::get_resize 3
+// and 5; past the end the last value is repeated
+float resize_sample(__global const float* line, const unsigned int length, const unsigned int step,
+                    const float pos, const unsigned int cubic){
+
+  unsigned int i = (unsigned int)pos;
+  float t = pos - i;
+  float v1 = line[(size_t)i * step];
+  float v2 = i + 1 < length ? line[(size_t)(i + 1) * step] : v1;
+  if (!cubic) {
+    return (1 - t) * v1 + t * v2;
+  }
+  float v0 = i > 0 ? line[(size_t)(i - 1) * step] : v1;
+  float v3 = i + 2 < length ? line[(size_t)(i + 2) * step] : v2;
+  return v1 + 0.5f * (t * (-v0 + v2) + t * t * (2 * v0 - 5 * v1 + 4 * v2 - v3) +
+                      t * t * t * (-v0 + 3 * v1 - 3 * v2 + v3));
+}
+
+// The x pass of CImg::get_resize: every row of every plane, in_width
+// values, to out_width values. Output x samples the input at
+// min(x * scale, in_width - 1), scale = (in_width - 1) / (out_width - 1)
+// as CImg does with Dirichlet boundaries (the default) when enlarging.
+// Range: (out_width, rows) with rows = height * planes.
+__kernel void resize_rows(
+  __global const float* in,
+  __global float* out,
+  const unsigned int in_width,
+  const unsigned int out_width,
+  const unsigned int rows,
+  const float scale,
+  const unsigned int cubic){
+
+  unsigned int x = get_global_id(0);
+  unsigned int row = get_global_id(1);
+  if (x >= out_width || row >= rows) {
+    return;
+  }
+  float pos = min(x * scale, (float)(in_width - 1));
+  out[(size_t)row * out_width + x] = resize_sample(in + (size_t)row * in_width, in_width, 1, pos, cubic);
+}
+
+// The y pass: every column of every plane, in_height values, to
+// out_height values. Range: (width, out_height, planes).
+__kernel void resize_columns(
+  __global const float* in,
+  __global float* out,
+  const unsigned int width,
+  const unsigned int in_height,
+  const unsigned int out_height,
+  const float scale,
+  const unsigned int cubic){
+
+  unsigned int x = get_global_id(0);
+  unsigned int y = get_global_id(1);
+  unsigned int plane = get_global_id(2);
+  if (x >= width || y >= out_height) {
+    return;
+  }
+  float pos = min(y * scale, (float)(in_height - 1));
+  __global const float* column = in + (size_t)plane * width * in_height + x;
+  out[((size_t)plane * out_height + y) * width + x] = resize_sample(column, in_height, width, pos, cubic);
+}
+
+
+// in(x, y) with Dirichlet boundaries: 0 out of the image
+float rotate_at(__global const float* plane, const int width, const int height, const int x, const int y){
+  return x >= 0 && y >= 0 && x < width && y < height ? plane[y * width + x] : 0.0f;
+}
+
+// CImg::get_rotate(angle) with its defaults, linear interpolation and
+// Dirichlet boundaries: output (x, y) samples the input at
+//   (w2 + xc * ca + yc * sa, h2 - xc * sa + yc * ca),
+//   xc = x - rw2, yc = y - rh2,
+// with (w2, h2) and (rw2, rh2) the centers of the input and the output.
+// The host sizes the output and passes the cosine and sine of the angle.
+// Range: (out_width, out_height, planes).
+__kernel void rotate_linear(
+  __global const float* in,
+  __global float* out,
+  const unsigned int width,
+  const unsigned int height,
+  const unsigned int out_width,
+  const unsigned int out_height,
+  const float4 rotation,     // (ca, sa, w2, h2)
+  const float2 out_center){  // (rw2, rh2)
+
+  unsigned int x = get_global_id(0);
+  unsigned int y = get_global_id(1);
+  unsigned int plane = get_global_id(2);
+  if (x >= out_width || y >= out_height) {
+    return;
+  }
+  float xc = x - out_center.x;
+  float yc = y - out_center.y;
+  float fx = rotation.z + xc * rotation.x + yc * rotation.y;
+  float fy = rotation.w - xc * rotation.y + yc * rotation.x;
+
+  int ix = (int)fx - (fx >= 0 ? 0 : 1);
+  int iy = (int)fy - (fy >= 0 ? 0 : 1);
+  float dx = fx - ix;
+  float dy = fy - iy;
+  __global const float* src = in + (size_t)plane * width * height;
+  float icc = rotate_at(src, width, height, ix, iy);
+  float inc = rotate_at(src, width, height, ix + 1, iy);
+  float icn = rotate_at(src, width, height, ix, iy + 1);
+  float inn = rotate_at(src, width, height, ix + 1, iy + 1);
+  out[((size_t)plane * out_height + y) * out_width + x] =
+    icc + (inc - icc + (icc + inn - icn - inc) * dy) * dx + (icn - icc) * dy;
+}
+
+
+// CImg::get_histogram(levels, vmin, vmax), first step: every work-group
+// counts its share of the values (work-items stride over the whole input)
+// into a histogram in local memory (`counts`, levels uints) with local
+// atomics, then writes it as partial[group * levels + bucket]. Value v in
+// [vmin, vmax] goes to bucket (v - vmin) * levels / (vmax - vmin), vmax to
+// the last one. Range: groups * local size, a few groups per compute unit.
+__kernel void histogram_partial(
+  __global const float* in,
+  const unsigned int count,
+  const unsigned int levels,
+  const float vmin,
+  const float vmax,
+  __global unsigned int* partial,
+  __local unsigned int* counts){
+
+  unsigned int lid = get_local_id(0);
+  unsigned int group_size = get_local_size(0);
+  for (unsigned int b = lid; b < levels; b += group_size) {
+    counts[b] = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (unsigned int i = get_global_id(0); i < count; i += get_global_size(0)) {
+    float v = in[i];
+    if (v >= vmin && v <= vmax) {
+      unsigned int b = v == vmax ? levels - 1 : (unsigned int)((v - vmin) * levels / (vmax - vmin));
+      atomic_inc(&counts[min(b, levels - 1)]);
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  __global unsigned int* mine = partial + (size_t)get_group_id(0) * levels;
+  for (unsigned int b = lid; b < levels; b += group_size) {
+    mine[b] = counts[b];
+  }
+}
+
+// Second step: bucket b of the histogram is the sum of bucket b of the
+// `groups` partial histograms. Range: levels.
+__kernel void histogram_reduce(
+  __global const unsigned int* partial,
+  const unsigned int groups,
+  const unsigned int levels,
+  __global unsigned int* histogram){
+
+  unsigned int b = get_global_id(0);
+  if (b >= levels) {
+    return;
+  }
+  unsigned int sum = 0;
+  for (unsigned int g = 0; g < groups; ++g) {
+    sum += partial[(size_t)g * levels + b];
+  }
+  histogram[b] = sum;
+}
@@ -23,4 +23,71 @@ __kernel void image_flip(
     image[mirror_index * 3 + 2] = temp.z;
     
   }
-}
\ No newline at end of file
+}
+
+// Same flip on CImg's planar layout: `planes` planes of width * height
+// bytes (RRR...GGG...BBB...), so the host uploads img.data() as it is.
+// One work-item per pixel of the left half of every row of every plane:
+// global size (width / 2) * height * planes.
+__kernel void image_flip_planar(
+  __global unsigned char* image,
+  const unsigned int width,
+  const unsigned int height,
+  const unsigned int planes){
+
+  unsigned int x = get_global_id(0);
+  unsigned int half_width = width / 2;
+  if (half_width == 0) {  // a 1 pixel wide image is its own mirror
+    return;
+  }
+
+  unsigned int row = x / half_width;    // row of the whole stack of planes
+  unsigned int pos = x % half_width;
+
+  if (row < height * planes) {
+    unsigned int index = row * width + pos;
+    unsigned int mirror_index = row * width + (width - 1 - pos);
+    unsigned char temp = image[index];
+    image[index] = image[mirror_index];
+    image[mirror_index] = temp;
+  }
+}
+
+
+// image_flip_planar on a 2D range: dimension 1 is the row of the stack of
+// planes and dimension 0 a block of 16 bytes of the left half of the row.
+// Each work-item loads its block and the mirrored block of the right half
+// as uchar16 (16 bytes, the size of a uint4), reverses both in registers
+// and stores them swapped, so there is no idle work-item, no byte access
+// and no division. Work-item half_width / 16 swaps the bytes left over
+// near the middle. Global size: (width / 2 / 16 + 1, height * planes),
+// it may be rounded up to a multiple of the work-group shape.
+__kernel void image_flip_2d(
+  __global unsigned char* image,
+  const unsigned int width,
+  const unsigned int rows){
+
+  unsigned int x = get_global_id(0);
+  unsigned int row = get_global_id(1);
+  unsigned int half_width = width / 2;
+  unsigned int blocks = half_width / 16;
+
+  if (row >= rows) {
+    return;
+  }
+  __global unsigned char* line = image + (size_t)row * width;
+  if (x < blocks) {
+    unsigned int left = x * 16;
+    unsigned int right = width - left - 16;
+    uchar16 a = vload16(0, line + left);
+    uchar16 b = vload16(0, line + right);
+    vstore16(b.sFEDCBA9876543210, 0, line + left);
+    vstore16(a.sFEDCBA9876543210, 0, line + right);
+  } else if (x == blocks) {
+    for (unsigned int pos = blocks * 16; pos < half_width; ++pos) {
+      unsigned char temp = line[pos];
+      line[pos] = line[width - 1 - pos];
+      line[width - 1 - pos] = temp;
+    }
+  }
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define cimg_display 0
+#include "CImg.h"
+
+#include <benchmark.hpp>
+#include <parallel_histogram.hpp>
+
+// parallel_histogram against CImg's serial get_histogram on a random
+// image, for float and unsigned char pixels:
+//  - cimg: img.get_histogram(levels, min, max)
+//  - private: per-thread histograms merged in a tree
+//  - atomic: one shared histogram of atomics, forced, or taken by
+//    parallel_histogram itself when private histograms would not pay off
+//    (histogram_use_atomics); such a row is not measured twice
+
+using namespace cimg_library;
+
+struct options {
+    size_t width = 4096, height = 4096;
+    size_t levels = 256;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t warmups = 1;
+    size_t trials = 5;
+};
+
+options usage(int argc, char *argv[]) {
+    options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--width=") == 0) {
+            opt.width = std::stoll(arg.substr(8));
+        } else if (arg.compare(0, 9, "--height=") == 0) {
+            opt.height = std::stoll(arg.substr(9));
+        } else if (arg.compare(0, 9, "--levels=") == 0) {
+            opt.levels = std::stoll(arg.substr(9));
+        } else if (arg.compare(0, 14, "--max-threads=") == 0) {
+            opt.max_threads = std::stoll(arg.substr(14));
+        } else if (arg.compare(0, 9, "--trials=") == 0) {
+            opt.trials = std::stoll(arg.substr(9));
+        } else {
+            std::cerr << "Invalid syntax: histogram_scaling [--width=<pixels>] [--height=<pixels>] "
+                "[--levels=<n>] [--max-threads=<n>] [--trials=<n>]" << std::endl;
+            exit(1);
+        }
+    }
+    if (!opt.width || !opt.height || !opt.levels || !opt.max_threads || !opt.trials) {
+        std::cerr << "All the arguments must be positive" << std::endl;
+        exit(1);
+    }
+    return opt;
+}
+
+template <typename F>
+double time_it(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+template <typename T>
+void run(const std::string &type, const CImg<T> &img, T min_value, T max_value,
+        const options &opt) {
+
+    auto reference = img.get_histogram(opt.levels, min_value, max_value);
+    auto cimg = summarize(measure(opt.warmups, opt.trials, [&] {
+        return time_it([&] { img.get_histogram(opt.levels, min_value, max_value); });
+    }));
+    std::cout << type << ", cimg, 1, " << cimg.median * 1e3 << ", 1" << std::endl;
+
+    for (size_t threads = 1; threads <= opt.max_threads; ++threads) {
+        bool atomic_measured = false;
+        for (bool atomics : {false, true}) {
+            histogram_options hopt;
+            hopt.threads = threads;
+            if (atomics) {
+                if (threads == 1 || atomic_measured) {
+                    continue;
+                }
+                hopt.private_bytes = 0;
+            }
+            // the label is the path parallel_histogram takes, not the one asked for
+            const bool shared = histogram_use_atomics(img.size(), opt.levels, hopt);
+            atomic_measured = atomic_measured || shared;
+            auto result = parallel_get_histogram(img, opt.levels, min_value, max_value, hopt);
+            if (result != reference) {
+                std::cerr << type << " histogram with " << threads << " threads differs from CImg" << std::endl;
+                exit(1);
+            }
+            auto st = summarize(measure(opt.warmups, opt.trials, [&] {
+                return time_it([&] { parallel_get_histogram(img, opt.levels, min_value, max_value, hopt); });
+            }));
+            std::cout << type << ", " << (shared ? "atomic" : "private") << ", " << threads << ", "
+                << st.median * 1e3 << ", " << cimg.median / st.median << std::endl;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    auto opt = usage(argc, argv);
+
+    std::mt19937 gen(42);
+    std::normal_distribution<float> dis(128.0f, 40.0f);
+    CImg<float> image(opt.width, opt.height, 1, 1);
+    cimg_for(image, p, float) {
+        *p = dis(gen);
+    }
+    // values below 0 and above 255 fall out of the range and are dropped
+    CImg<unsigned char> pixels(image.width(), image.height(), 1, 1);
+    cimg_forXY(image, x, y) {
+        pixels(x, y) = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, image(x, y))));
+    }
+
+    std::cout << "type, variant, threads, median (ms), speedup vs cimg" << std::endl;
+    run("float", image, 0.0f, 255.0f, opt);
+    run("uchar", pixels, static_cast<unsigned char>(0), static_cast<unsigned char>(255), opt);
+}
@@ -1,24 +1,75 @@
+#include <algorithm>
+#include <deque>
 #include <future>
 #include <iostream>
 #include <random>
+#include <string>
 #include <vector>
 
 // assume a container
+// writes [begin, end) straight into the caller's z, no temporaries
 template <typename T>
-T saxpy(const typename T::value_type A, const T& x, const T& y,
+void saxpy(T& z, const typename T::value_type A, const T& x, const T& y,
         size_t begin, size_t end)
 {
-    T z(x.size());
-
     for(size_t i = begin; i < end; ++i) {
          z[i] = A * x[i] + y[i];
     }
+}
+
+// returns only the chunk [begin, end)
+template <typename T>
+T saxpy_chunk(const typename T::value_type A, const T& x, const T& y,
+        size_t begin, size_t end)
+{
+    T z(end - begin);
+
+    for(size_t i = begin; i < end; ++i) {
+         z[i - begin] = A * x[i] + y[i];
+    }
     return z;
 }
 
-int main() {
+// Computes saxpy in chunks of `chunk` elements with at most `in_flight`
+// chunks running at once, and hands every chunk to consume(begin, z) in
+// order as soon as it is ready. The output never exists in full: memory
+// is bounded by in_flight * chunk, and consuming a chunk overlaps with
+// computing the next ones.
+template <typename T, typename Consumer>
+void saxpy_stream(const typename T::value_type A, const T& x, const T& y,
+        size_t chunk, size_t in_flight, Consumer consume)
+{
+    const size_t N = x.size();
+    std::deque<std::pair<size_t, std::future<T>>> pending;
+    size_t next = 0;
+    while (next < N || !pending.empty()) {
+        while (next < N && pending.size() < in_flight) {
+            size_t end = std::min(N, next + chunk);
+            pending.emplace_back(next, std::async(std::launch::async, saxpy_chunk<T>,
+                        A, std::cref(x), std::cref(y), next, end));
+            next = end;
+        }
+        consume(pending.front().first, pending.front().second.get());
+        pending.pop_front();
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 4) {
+        std::cerr << "Invalid syntax: saxpy_future [N] [chunk] [in_flight]" << std::endl;
+        exit(1);
+    }
+
+    const size_t N = argc > 1 ? std::stoll(argv[1]) : 8;
+    const size_t chunk = argc > 2 ? std::stoll(argv[2]) : 2;
+    const size_t in_flight = argc > 3 ? std::stoll(argv[3]) : 2;
+    if (chunk == 0 || in_flight == 0) {
+        std::cerr << "chunk and in_flight must be positive" << std::endl;
+        exit(1);
+    }
+    const bool print = N <= 16;
 
-    const size_t N = 8;
     const float A = 3.14f;
     using vf = std::vector<float>;
     vf z(N, 0.0f);
@@ -33,29 +84,51 @@ int main() {
         y.push_back(dis(gen));
     }
 
-    auto first_half =  std::async(std::launch::async, saxpy<vf>, A, std::ref(x), std::ref(y), 0, N/2);
-    auto second_half = std::async(std::launch::deferred, saxpy<vf>, A, std::ref(x), std::ref(y), N/2, N);
+    // both halves write into z, the futures only signal completion
+    auto first_half =  std::async(std::launch::async, saxpy<vf>, std::ref(z), A, std::cref(x), std::cref(y), 0, N/2);
+    auto second_half = std::async(std::launch::deferred, saxpy<vf>, std::ref(z), A, std::cref(x), std::cref(y), N/2, N);
+    first_half.get();
+    second_half.get();
 
-    std::cout << "x:";
-    for(const auto i: x) {
-        std::cout << " " << i;
-    }
-    std::cout << std::endl;
+    if (print) {
+        std::cout << "x:";
+        for(const auto i: x) {
+            std::cout << " " << i;
+        }
+        std::cout << std::endl;
+
+        std::cout << "y:";
+        for(const auto i: y) {
+            std::cout << " " << i;
+        }
+        std::cout << std::endl;
 
-    std::cout << "y:";
-    for(const auto i: y) {
-        std::cout << " " << i;
+        std::cout << "z:";
+        for(const auto i: z) {
+            std::cout << " " << i;
+        }
+        std::cout << std::endl;
     }
-    std::cout << std::endl;
 
-    std::cout << "z:";
-    for(const auto i: first_half.get()) {
-        std::cout << " " << i;
+    // the same result, chunk by chunk
+    size_t mismatches = 0;
+    if (print) {
+        std::cout << "z (streamed):";
     }
-    for(const auto i: second_half.get()) {
-        std::cout << " " << i;
+    saxpy_stream(A, x, y, chunk, in_flight, [&](size_t begin, const vf& part) {
+        for(size_t i = 0; i < part.size(); ++i) {
+            mismatches += part[i] != z[begin + i];
+            if (print) {
+                std::cout << " " << part[i];
+            }
+        }
+    });
+    if (print) {
+        std::cout << std::endl;
     }
-    std::cout << std::endl;
 
+    if (mismatches) {
+        std::cerr << mismatches << " streamed elements differ" << std::endl;
+        exit(1);
+    }
 }
-
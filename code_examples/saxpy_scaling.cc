@@ -1,9 +1,16 @@
-#include <chrono>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <random>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include <benchmark.hpp>
+#include <huge_page_allocator.hpp>
+#include <parallel_reduce.hpp>
+#include <saxpy_simd.hpp>
+
 // assume a container
 template <typename T>
 void saxpy(T& z, const typename T::value_type A, const T& x, const T& y,
@@ -14,87 +21,167 @@ void saxpy(T& z, const typename T::value_type A, const T& x, const T& y,
     }
 }
 
-typedef struct {
-    size_t large_chunk;
-    size_t small_chunk;
-    size_t split_item;
-} chunk_info;
-
-// For a given number of iterations N and threads
-// the iterations are divided:
-// N % threads receive N / threads + 1 iterations
-// the rest receive N / threads
-constexpr chunk_info
-split_evenly(size_t N, size_t threads)
+// STREAM copy, used as the bandwidth ceiling (roofline) of the machine
+template <typename T>
+void copy(T& z, const T& x, size_t begin, size_t end)
 {
-    return {N / threads + 1, N / threads, N % threads};
+    for(size_t i = begin; i < end; ++i) {
+         z[i] = x[i];
+    }
 }
 
-std::pair<size_t, size_t>
-get_chunk_begin_end(const chunk_info& ci, size_t index)
-{
-    size_t begin = 0, end = 0;
-    if (index < ci.split_item ) {
-        begin = index*ci.large_chunk;
-        end = begin + ci.large_chunk; // (index + 1) * ci.large_chunk
-    } else {
-        begin = ci.split_item*ci.large_chunk + (index - ci.split_item) * ci.small_chunk;
-        end = begin + ci.small_chunk;
+struct options {
+    size_t N = 1 << 26;
+    size_t max_threads = std::min(48u, std::thread::hardware_concurrency());
+    size_t warmups = 2;
+    size_t trials = 10;
+    std::string csv;
+    std::string json;
+    int stream = -1;    // non-temporal stores: -1 auto, 0 never, 1 always
+};
+
+options usage(int argc, char *argv[]) {
+    options opt;
+    const std::string host = host_name();
+    opt.csv = "saxpy_scaling_" + host + ".csv";
+    opt.json = "saxpy_scaling_" + host + ".json";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](size_t prefix) { return arg.substr(prefix); };
+        if (arg.compare(0, 7, "--size=") == 0) {
+            opt.N = std::stoll(value(7));
+        } else if (arg.compare(0, 14, "--max-threads=") == 0) {
+            opt.max_threads = std::stoll(value(14));
+        } else if (arg.compare(0, 10, "--warmups=") == 0) {
+            opt.warmups = std::stoll(value(10));
+        } else if (arg.compare(0, 9, "--trials=") == 0) {
+            opt.trials = std::stoll(value(9));
+        } else if (arg.compare(0, 6, "--csv=") == 0) {
+            opt.csv = value(6);
+        } else if (arg.compare(0, 7, "--json=") == 0) {
+            opt.json = value(7);
+        } else if (arg == "--stream=auto" || arg == "--stream=on" || arg == "--stream=off") {
+            opt.stream = arg == "--stream=auto" ? -1 : arg == "--stream=on";
+        } else {
+            std::cerr << "Invalid syntax: saxpy_scaling [--size=<elements>] [--max-threads=<n>] "
+                "[--warmups=<n>] [--trials=<n>] [--csv=<file>] [--json=<file>] "
+                "[--stream=auto|on|off]" << std::endl;
+            exit(1);
+        }
+    }
+    if (opt.N == 0 || opt.max_threads == 0 || opt.trials == 0) {
+        std::cerr << "Size, threads and trials must be positive" << std::endl;
+        exit(1);
     }
-    return std::make_pair(begin, end);
+    return opt;
+}
+
+// time one kernel over [0, N) split evenly among the team
+template <typename F>
+sample_stats time_kernel(worker_team &team, size_t N, const options &opt, F kernel)
+{
+    auto chunks = split_evenly(N, team.size());
+    auto job = [&](size_t id) {
+        auto begin_end = get_chunk_begin_end(chunks, id);
+        kernel(begin_end.first, begin_end.second);
+    };
+    return summarize(measure(opt.warmups, opt.trials, [&] { return team.run(job); }));
 }
 
-int main() {
+using vf = huge_vector<float>;
 
-    const size_t N = 1024*1024*1024;
+// First touch: the vectors are allocated afresh and every thread of the
+// team initializes the chunk it computes on, with its own RNG stream, so
+// the pages land on its NUMA node and the fill is not serialized on one
+// generator. Pages keep the node of their first writer, so this is done
+// again for every team size measured.
+void first_touch(worker_team &team, size_t N, unsigned seed, vf &z, vf &x, vf &y)
+{
+    // release the old pages first, or the new vectors could reuse them
+    z = vf(); x = vf(); y = vf();
+    z = vf(N); x = vf(N); y = vf(N);
+    auto chunks = split_evenly(N, team.size());
+    team.run([&](size_t id) {
+        auto begin_end = get_chunk_begin_end(chunks, id);
+        std::seed_seq seq{seed, static_cast<unsigned>(id)};
+        std::mt19937 gen(seq);
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        for(size_t i = begin_end.first; i < begin_end.second; ++i) {
+            x[i] = dis(gen);
+            y[i] = x[i]; // reduce execution time
+            z[i] = 0.0f;
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+
+    auto opt = usage(argc, argv);
+    const size_t N = opt.N;
     const float A = 3.14f;
-    using vf = std::vector<float>;
-    vf z(N, 0.0f);
-    vf x, y;
+    // allocated by first_touch
+    vf z, x, y;
 
     std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    const unsigned seed = rd();
 
-    for(size_t i = 0; i < N; ++i) {
-        float value = dis(gen);
-        x.push_back(value);
-        y.push_back(value); // reduce execution time
+    // bandwidth ceiling with every thread, from the median like every row
+    double roofline_gbs = 0;
+    {
+        worker_team widest(opt.max_threads);
+        first_touch(widest, N, seed, z, x, y);
+        auto st = time_kernel(widest, N, opt, [&](size_t b, size_t e) { copy(z, x, b, e); });
+        roofline_gbs = 2.0 * N * sizeof(float) / st.median / 1e9;
     }
+    std::cout << "STREAM copy roofline: " << roofline_gbs << " GB/s" << std::endl;
 
-    std::vector<std::thread> thread_vector;
-    std::vector<std::chrono::milliseconds> extime_thread;
+    const bool stream = opt.stream < 0 ? saxpy_should_stream(N) : opt.stream == 1;
+    std::cout << "Non-temporal stores: " << (stream ? "on" : "off") << std::endl;
 
-    size_t max_threads = std::min(48u, std::thread::hardware_concurrency());
-    for(size_t current_threads = 1; current_threads <= max_threads; ++current_threads) {
-
-        auto chunks = split_evenly(N, current_threads);
-        // ToDo : run several times and check median and deviation
-        // launch the work
-        auto start = std::chrono::steady_clock::now();
-        for(size_t i = 0; i < current_threads; ++i) {
-            auto begin_end = get_chunk_begin_end(chunks, i);
-            thread_vector.push_back(std::thread(saxpy<vf>, std::ref(z), A,
-                    std::ref(x), std::ref(y), begin_end.first, begin_end.second));
-            std::cout << i << ", " << begin_end.first << ", " << begin_end.second << std::endl;
+    // the vector kernels must match the scalar loop up to FMA rounding
+    vf reference(N);
+    saxpy(reference, A, x, y, 0, N);
+    for (auto level : simd_levels()) {
+        saxpy_simd(level, z.data(), A, x.data(), y.data(), N, stream);
+        bool equal = true;
+        for (size_t i = 0; i < N && equal; ++i) {
+            equal = std::fabs(z[i] - reference[i]) <= 1e-6f * std::fabs(reference[i]);
         }
-
-        // wait for completion
-        for(size_t i = 0; i < current_threads; ++i) {
-            thread_vector[i].join();
+        if (!equal) {
+            std::cerr << "Kernel " << simd_name(level) << " differs from the scalar loop" << std::endl;
+            exit(1);
         }
-        auto stop = std::chrono::steady_clock::now();
-        extime_thread.push_back(
-                std::chrono::duration_cast<std::chrono::milliseconds>
-                (stop-start));
-
-        // clean the vector array
-        thread_vector.clear();
     }
+    reference = vf();
+
+    // saxpy reads x and y and writes z
+    const double bytes = 3.0 * N * sizeof(float);
+    std::vector<benchmark_row> rows;
+    std::cout << "variant, threads, median (ms), MAD (ms), 95% CI (ms), GB/s, % roofline" << std::endl;
+    for(size_t current_threads = 1; current_threads <= opt.max_threads; ++current_threads) {
+        // threads are created here, outside the timed region
+        worker_team team(current_threads);
+        first_touch(team, N, seed, z, x, y);
+        for (auto level : simd_levels()) {
+            sample_stats st;
+            if (level == simd_level::scalar) {
+                st = time_kernel(team, N, opt, [&](size_t b, size_t e) { saxpy(z, A, x, y, b, e); });
+            } else {
+                st = time_kernel(team, N, opt, [&](size_t b, size_t e) {
+                    saxpy_simd(level, z.data() + b, A, x.data() + b, y.data() + b, e - b, stream);
+                });
+            }
+            rows.push_back(benchmark_row{simd_name(level), current_threads, st, bytes});
 
-    std::cout << "threads, time (ms)" << std::endl;
-    for(size_t i = 0; i < extime_thread.size(); ++i) {
-        std::cout << i+1 << ", " << extime_thread[i].count() << std::endl;
+            const auto &r = rows.back();
+            std::cout << r.variant << ", " << current_threads << ", " << st.median * 1e3
+                << ", " << st.mad * 1e3
+                << ", [" << st.ci_low * 1e3 << ", " << st.ci_high * 1e3 << "], "
+                << r.bandwidth_gbs() << ", " << 100 * r.bandwidth_gbs() / roofline_gbs << std::endl;
+        }
     }
-}
 
+    write_csv(opt.csv, rows, roofline_gbs);
+    write_json(opt.json, "saxpy_scaling", N, rows, roofline_gbs);
+    std::cout << "Results written to " << opt.csv << " and " << opt.json << std::endl;
+}
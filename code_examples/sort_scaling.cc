@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define cimg_display 0
+#include "CImg.h"
+
+#include <benchmark.hpp>
+#include <parallel_sort.hpp>
+
+// parallel_sort against std::sort and CImg's serial quicksort on pixel
+// arrays with different distributions:
+//  - uniform: floats in [0, 1)
+//  - skewed: exponential floats, most values close to 0 (exercise 6b)
+//  - duplicates: 16 distinct values
+//  - ints: uniform 32-bit integers (radix sort path)
+// and key-value sorting as in CImg's sort(permutations).
+
+using namespace cimg_library;
+
+struct options {
+    size_t N = 1 << 24;
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t warmups = 1;
+    size_t trials = 3;
+};
+
+options usage(int argc, char *argv[]) {
+    options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 7, "--size=") == 0) {
+            opt.N = std::stoll(arg.substr(7));
+        } else if (arg.compare(0, 14, "--max-threads=") == 0) {
+            opt.max_threads = std::stoll(arg.substr(14));
+        } else if (arg.compare(0, 9, "--trials=") == 0) {
+            opt.trials = std::stoll(arg.substr(9));
+        } else {
+            std::cerr << "Invalid syntax: sort_scaling [--size=<elements>] [--max-threads=<n>] "
+                "[--trials=<n>]" << std::endl;
+            exit(1);
+        }
+    }
+    if (!opt.N || !opt.max_threads || !opt.trials) {
+        std::cerr << "All the arguments must be positive" << std::endl;
+        exit(1);
+    }
+    return opt;
+}
+
+// times sort(copy) on a fresh copy of data for every trial
+template <typename T, typename F>
+sample_stats time_sort(const CImg<T> &data, const options &opt, F sort) {
+    std::vector<double> times;
+    for (size_t i = 0; i < opt.warmups + opt.trials; ++i) {
+        CImg<T> copy(data);
+        auto start = std::chrono::steady_clock::now();
+        sort(copy);
+        auto stop = std::chrono::steady_clock::now();
+        if (i >= opt.warmups) {
+            times.push_back(std::chrono::duration<double>(stop - start).count());
+        }
+    }
+    return summarize(times);
+}
+
+template <typename T>
+void run(const std::string &name, const CImg<T> &data, const options &opt) {
+
+    CImg<T> reference = data.get_sort();
+    auto cimg = time_sort(data, opt, [](CImg<T> &c) { c.sort(); });
+    auto stl = time_sort(data, opt, [](CImg<T> &c) { std::sort(c.begin(), c.end()); });
+    std::cout << name << ", cimg, 1, " << cimg.median * 1e3 << ", 1" << std::endl;
+    std::cout << name << ", std::sort, 1, " << stl.median * 1e3 << ", "
+        << cimg.median / stl.median << std::endl;
+
+    for (size_t threads = 1; threads <= opt.max_threads; ++threads) {
+        sort_options sopt;
+        sopt.threads = threads;
+        CImg<T> sorted(data);
+        parallel_cimg_sort(sorted, true, sopt);
+        if (sorted != reference) {
+            std::cerr << name << " sorted with " << threads << " threads differs from CImg" << std::endl;
+            exit(1);
+        }
+        auto st = time_sort(data, opt, [&](CImg<T> &c) { parallel_cimg_sort(c, true, sopt); });
+        std::cout << name << ", parallel, " << threads << ", " << st.median * 1e3 << ", "
+            << cimg.median / st.median << std::endl;
+    }
+
+    // key-value: the permutation must map the input to the sorted output
+    CImg<unsigned int> perm;
+    CImg<T> sorted(data);
+    parallel_cimg_sort(sorted, perm, true);
+    bool valid = sorted == reference;
+    std::vector<bool> seen(data.size(), false);
+    for (size_t i = 0; i < data.size() && valid; ++i) {
+        valid = perm[i] < data.size() && !seen[perm[i]] && data[perm[i]] == sorted[i];
+        seen[perm[i]] = true;
+    }
+    if (!valid) {
+        std::cerr << name << " permutation is wrong" << std::endl;
+        exit(1);
+    }
+    auto cimg_perm = time_sort(data, opt, [](CImg<T> &c) { CImg<unsigned int> p; c.sort(p); });
+    auto par_perm = time_sort(data, opt, [](CImg<T> &c) { CImg<unsigned int> p; parallel_cimg_sort(c, p); });
+    std::cout << name << ", cimg permutations, 1, " << cimg_perm.median * 1e3 << ", 1" << std::endl;
+    std::cout << name << ", parallel permutations, " << sort_options().threads << ", "
+        << par_perm.median * 1e3 << ", " << cimg_perm.median / par_perm.median << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+
+    auto opt = usage(argc, argv);
+    std::mt19937 gen(42);
+
+    CImg<float> uniform(opt.N), skewed(opt.N), duplicates(opt.N);
+    CImg<int> ints(opt.N);
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    std::exponential_distribution<float> e(50.0f);
+    std::uniform_int_distribution<int> d(0, 15), i32(std::numeric_limits<int>::min(),
+                                                     std::numeric_limits<int>::max());
+    for (size_t i = 0; i < opt.N; ++i) {
+        uniform[i] = u(gen);
+        skewed[i] = e(gen);
+        duplicates[i] = d(gen);
+        ints[i] = i32(gen);
+    }
+
+    std::cout << "data, variant, threads, median (ms), speedup vs cimg" << std::endl;
+    run("uniform", uniform, opt);
+    run("skewed", skewed, opt);
+    run("duplicates", duplicates, opt);
+    run("ints", ints, opt);
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Helpers for scaling benchmarks: a team of threads created outside the
+// timed region, repeated trials with warm-ups, robust statistics and
+// CSV/JSON output.
+
+// Fixed team of threads. run() releases all of them at once and times the
+// job from the release until the last thread finishes; the calling thread
+// is worker 0.
+class worker_team
+{
+  size_t _size;
+  std::atomic<size_t> _generation;
+  std::atomic<size_t> _finished;
+  std::atomic<bool> _stop;
+  std::function<void(size_t)> _job;
+  std::vector<std::thread> _threads;
+
+  void worker(size_t id)
+  {
+    size_t seen = 0;
+    while (true) {
+      while (_generation == seen && !_stop) {
+        std::this_thread::yield();
+      }
+      if (_stop) {
+        return;
+      }
+      seen = _generation;
+      _job(id);
+      ++_finished;
+    }
+  }
+
+  public:
+  explicit worker_team(size_t size)
+    : _size(std::max<size_t>(size, 1)), _generation(0), _finished(0), _stop(false)
+  {
+    for (size_t id = 1; id < _size; ++id) {
+      _threads.push_back(std::thread(&worker_team::worker, this, id));
+    }
+  }
+
+  ~worker_team()
+  {
+    _stop = true;
+    for (auto& t : _threads) {
+      t.join();
+    }
+  }
+
+  worker_team(const worker_team&) = delete;
+  worker_team& operator=(const worker_team&) = delete;
+
+  size_t size() const { return _size; }
+
+  // returns the elapsed time in seconds
+  double run(const std::function<void(size_t)>& job)
+  {
+    _job = job;
+    _finished = 0;
+    auto start = std::chrono::steady_clock::now();
+    ++_generation;
+    _job(0);
+    while (_finished != _size - 1) {
+      std::this_thread::yield();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+  }
+};
+
+// times `warmups` + `trials` calls of f() (which returns seconds) and
+// keeps the trials
+template<typename F>
+std::vector<double> measure(size_t warmups, size_t trials, F f)
+{
+  for (size_t i = 0; i < warmups; ++i) {
+    f();
+  }
+  std::vector<double> times;
+  for (size_t i = 0; i < trials; ++i) {
+    times.push_back(f());
+  }
+  return times;
+}
+
+struct sample_stats
+{
+  size_t n;
+  double min, max;
+  double median;
+  double mad;                 // median absolute deviation
+  double ci_low, ci_high;     // ~95% confidence interval of the median
+};
+
+inline double median_of_sorted(const std::vector<double>& v)
+{
+  size_t m = v.size() / 2;
+  return v.size() % 2 ? v[m] : (v[m - 1] + v[m]) / 2;
+}
+
+// The confidence interval of the median is distribution free: the order
+// statistics at ranks n/2 -+ 1.96 sqrt(n)/2. With very few trials it
+// degrades to [min, max].
+inline sample_stats summarize(std::vector<double> v)
+{
+  sample_stats st{};
+  st.n = v.size();
+  if (v.empty()) {
+    return st;
+  }
+  std::sort(v.begin(), v.end());
+  st.min = v.front();
+  st.max = v.back();
+  st.median = median_of_sorted(v);
+
+  std::vector<double> dev;
+  for (double x : v) {
+    dev.push_back(std::fabs(x - st.median));
+  }
+  std::sort(dev.begin(), dev.end());
+  st.mad = median_of_sorted(dev);
+
+  const double half_width = 1.96 * std::sqrt(double(st.n)) / 2;
+  const double centre = double(st.n) / 2;
+  const long low = long(std::floor(centre - half_width));
+  const long high = long(std::ceil(centre + half_width));
+  st.ci_low = v[std::max(0L, low)];
+  st.ci_high = v[std::min(long(st.n) - 1, high)];
+  return st;
+}
+
+// One measured configuration: `bytes` moved per run gives the bandwidth
+struct benchmark_row
+{
+  std::string variant;
+  size_t threads;
+  sample_stats time;
+  double bytes;
+
+  double bandwidth_gbs() const { return bytes / time.median / 1e9; }
+};
+
+inline std::string host_name()
+{
+  char name[256] = {0};
+  if (gethostname(name, sizeof(name) - 1) != 0) {
+    return "unknown";
+  }
+  return name;
+}
+
+inline void write_csv(const std::string& file, const std::vector<benchmark_row>& rows,
+                      double roofline_gbs)
+{
+  std::ofstream ofile(file, std::ios::out);
+  ofile << "variant,threads,trials,median_s,mad_s,ci_low_s,ci_high_s,min_s,max_s,"
+           "bandwidth_gbs,roofline_fraction" << std::endl;
+  for (const auto& r : rows) {
+    ofile << r.variant << "," << r.threads << "," << r.time.n << ","
+          << r.time.median << "," << r.time.mad << ","
+          << r.time.ci_low << "," << r.time.ci_high << ","
+          << r.time.min << "," << r.time.max << ","
+          << r.bandwidth_gbs() << "," << r.bandwidth_gbs() / roofline_gbs << std::endl;
+  }
+}
+
+inline void write_json(const std::string& file, const std::string& benchmark,
+                       size_t elements, const std::vector<benchmark_row>& rows,
+                       double roofline_gbs)
+{
+  std::ofstream ofile(file, std::ios::out);
+  ofile << "{" << std::endl;
+  ofile << "  \"benchmark\": \"" << benchmark << "\"," << std::endl;
+  ofile << "  \"host\": \"" << host_name() << "\"," << std::endl;
+  ofile << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "," << std::endl;
+  ofile << "  \"elements\": " << elements << "," << std::endl;
+  ofile << "  \"roofline_gbs\": " << roofline_gbs << "," << std::endl;
+  ofile << "  \"results\": [" << std::endl;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const auto& r = rows[i];
+    ofile << "    {\"variant\": \"" << r.variant << "\", \"threads\": " << r.threads
+          << ", \"trials\": " << r.time.n
+          << ", \"median_s\": " << r.time.median << ", \"mad_s\": " << r.time.mad
+          << ", \"ci_low_s\": " << r.time.ci_low << ", \"ci_high_s\": " << r.time.ci_high
+          << ", \"min_s\": " << r.time.min << ", \"max_s\": " << r.time.max
+          << ", \"bandwidth_gbs\": " << r.bandwidth_gbs() << "}"
+          << (i + 1 < rows.size() ? "," : "") << std::endl;
+  }
+  ofile << "  ]" << std::endl;
+  ofile << "}" << std::endl;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "cl_runtime.hpp"
+
+// Work-group shape autotuner. The best local size depends on the device
+// (SIMD width, compute units, cache lines) and on the kernel, so instead of
+// passing NULL or an arbitrary 128 the drivers time the kernel once with
+// every candidate shape and keep the fastest one.
+//
+// Candidates are the 1D sizes 32 .. 1024, the 2D shapes x * y with x * y
+// between 16 and the limit, and NULL (the implementation's choice), all
+// within the work-group limits of the kernel and of the device. The global
+// size is rounded up to a multiple of the shape, so kernels must ignore
+// work-items out of their range.
+//
+// The winner is stored in the cache directory of the runtime (next to the
+// program binaries) under the kernel, the hash of the program source and
+// its build options, the device and its compute units, the driver and the
+// global size, so later runs do not tune again and an edited kernel is
+// tuned anew. Sub-devices (cl_partition_equally) keep the name of their
+// parent, the compute units tell a 2-way split from a 4-way one.
+
+struct cl_tuning
+{
+  std::vector<size_t> local;  // empty for NULL
+  double seconds = 0;         // median kernel time with this shape
+  bool from_cache = false;
+
+  const size_t* local_size() const { return local.empty() ? NULL : local.data(); }
+
+  // global rounded up to a multiple of the shape
+  std::vector<size_t> global_size(cl_uint dims, const size_t* global) const
+  {
+    std::vector<size_t> rounded(global, global + dims);
+    for (size_t i = 0; i < local.size(); ++i) {
+      rounded[i] = (rounded[i] + local[i] - 1) / local[i] * local[i];
+    }
+    return rounded;
+  }
+
+  std::string name() const
+  {
+    if (local.empty()) {
+      return "NULL";
+    }
+    std::string text;
+    for (size_t i = 0; i < local.size(); ++i) {
+      text += (i ? "x" : "") + std::to_string(local[i]);
+    }
+    return text;
+  }
+};
+
+inline std::vector<std::vector<size_t>> cl_local_candidates(cl_runtime& runtime, size_t device, cl_kernel kernel,
+                                                            cl_uint dims, const size_t* global)
+{
+  const cl_device_desc& d = runtime.device(device);
+  size_t kernel_max = 0;
+  cl_error(clGetKernelWorkGroupInfo(kernel, d.id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_max, NULL),
+           "Failed to get kernel work group info");
+  size_t item_max[3] = { 0, 0, 0 };
+  cl_error(clGetDeviceInfo(d.id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(item_max), item_max, NULL),
+           "clGetDeviceInfo: Getting max work item sizes");
+  const size_t max = std::min(kernel_max, d.max_work_group_size);
+
+  // a shape much wider than the range would mostly idle
+  auto fits = [&](const std::vector<size_t>& local) {
+    size_t size = 1;
+    for (size_t i = 0; i < local.size(); ++i) {
+      if (local[i] > item_max[i] || (local[i] > 1 && local[i] >= 2 * global[i])) {
+        return false;
+      }
+      size *= local[i];
+    }
+    return size <= max;
+  };
+
+  std::vector<std::vector<size_t>> candidates(1);  // NULL
+  if (dims == 1) {
+    for (size_t x = 32; x <= 1024; x *= 2) {
+      candidates.push_back(std::vector<size_t>(1, x));
+    }
+  } else if (dims == 2) {
+    for (size_t x = 1; x <= 256; x *= 2) {
+      for (size_t y = 1; y <= 16; y *= 2) {
+        if (x * y >= 16) {
+          candidates.push_back({ x, y });
+        }
+      }
+    }
+  }
+  std::vector<std::vector<size_t>> valid(1);
+  for (size_t i = 1; i < candidates.size(); ++i) {
+    if (fits(candidates[i])) {
+      valid.push_back(candidates[i]);
+    }
+  }
+  return valid;
+}
+
+// `program` is cl_runtime::program_key of the program of the kernel
+inline std::string cl_tuning_key(const cl_device_desc& device, const std::string& program, const std::string& kernel,
+                                 cl_uint dims, const size_t* global)
+{
+  std::string key = "tune " + kernel + " | " + program + " | " + device.name + " | " +
+                    std::to_string(device.compute_units) + " compute units | " + device.driver_version + " |";
+  for (cl_uint i = 0; i < dims; ++i) {
+    key += " " + std::to_string(global[i]);
+  }
+  return key;
+}
+
+// Times `kernel` (arguments already set) with every shape, `trials` times
+// each, and returns the fastest one. The kernel runs many times on the
+// same buffers, so their content is undefined afterwards and must be
+// uploaded again.
+inline cl_tuning cl_autotune(cl_runtime& runtime, size_t device, cl_kernel kernel, const std::string& name,
+                             cl_uint dims, const size_t* global, size_t trials = 3)
+{
+  const std::string dir = runtime.cache_dir();
+  cl_program program = NULL;
+  cl_error(clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(program), &program, NULL),
+           "Failed to get kernel info");
+  const std::string key = cl_tuning_key(runtime.device(device), runtime.program_key(program), name, dims, global);
+  const std::string path = dir + "/" + cl_hex(cl_hash(key)) + ".tune";
+  cl_tuning best;
+
+  if (!dir.empty()) {
+    std::ifstream file(path);
+    std::string stored_key;
+    size_t n = 0;
+    if (std::getline(file, stored_key) && stored_key == key && file >> best.seconds >> n) {
+      best.local.resize(n);
+      for (auto& l : best.local) {
+        file >> l;
+      }
+      if (file) {
+        best.from_cache = true;
+        return best;
+      }
+    }
+    best = cl_tuning();
+  }
+
+  cl_command_queue queue = runtime.queue(device);
+  bool first = true;
+  for (const auto& local : cl_local_candidates(runtime, device, kernel, dims, global)) {
+    cl_tuning t;
+    t.local = local;
+    std::vector<size_t> rounded = t.global_size(dims, global);
+    std::vector<double> times;
+    for (size_t i = 0; i < trials; ++i) {
+      cl_event_ref event = cl_launch(queue, kernel, dims, rounded.data(), t.local_size());
+      cl_wait(event);
+      times.push_back(cl_event_seconds(event.get()));
+    }
+    std::sort(times.begin(), times.end());
+    t.seconds = times[times.size() / 2];
+    if (first || t.seconds < best.seconds) {
+      best = t;
+      first = false;
+    }
+  }
+
+  if (!dir.empty()) {
+    mkdir(dir.c_str(), 0755);
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    file << key << "\n" << best.seconds << " " << best.local.size();
+    for (size_t l : best.local) {
+      file << " " << l;
+    }
+    file << "\n";
+  }
+  return best;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Online load balancer handing the items [0, n) out to consumers (OpenCL
+// devices, the host thread pool) of unknown and different speeds.
+//
+//  - Every consumer reports the measured cost of each item it finishes;
+//    its cost per item is an exponential moving average of them, so it
+//    follows changes of speed (clocks, other load) during the run.
+//  - Items are handed out in chunks. A consumer with no measurement yet
+//    gets a single item (the probe). Afterwards it gets its share of half
+//    the items left, the share being its speed over the sum of speeds:
+//    chunks are large at the beginning, which keeps the lock cold, and
+//    shrink towards the end so that all consumers finish together.
+//  - When nothing is left to hand out, an idle consumer steals the second
+//    half of the largest chunk not started yet by another consumer, so a
+//    slow consumer never holds the last items alone.
+
+struct cl_balance_report
+{
+  size_t items = 0;           // items processed
+  size_t chunks = 0;          // chunks received from the pool
+  size_t stolen = 0;          // items taken from other consumers
+  double seconds_per_item = 0;
+};
+
+class cl_balancer
+{
+  struct consumer
+  {
+    size_t begin = 0, end = 0;  // items assigned and not started yet
+    double cost = 0;            // seconds per item, 0 until measured
+    cl_balance_report report;
+  };
+
+  std::mutex _mutex;
+  size_t _next;
+  size_t _items;
+  double _smoothing;
+  std::vector<consumer> _consumers;
+
+  // sizes a new chunk for consumer c, with the lock held
+  size_t chunk_size(size_t c) const
+  {
+    const size_t left = _items - _next;
+    if (_consumers[c].cost == 0) {
+      return 1;
+    }
+    double speed = 0, total = 0;
+    for (size_t i = 0; i < _consumers.size(); ++i) {
+      // consumers not measured yet count as fast as this one
+      const double cost = _consumers[i].cost ? _consumers[i].cost : _consumers[c].cost;
+      total += 1 / cost;
+      if (i == c) {
+        speed = 1 / cost;
+      }
+    }
+    return std::max<size_t>(1, std::min<size_t>(left, left * speed / total / 2));
+  }
+
+  public:
+  // smoothing: weight of the newest measurement in the moving average
+  cl_balancer(size_t items, size_t consumers, double smoothing = 0.3)
+      : _next(0), _items(items), _smoothing(smoothing), _consumers(consumers)
+  {}
+
+  // the next item for consumer c, false when all of them are taken
+  bool next(size_t c, size_t& item)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    consumer& me = _consumers[c];
+    if (me.begin == me.end && _next < _items) {
+      me.begin = _next;
+      me.end = _next += chunk_size(c);
+      ++me.report.chunks;
+    }
+    if (me.begin == me.end) {
+      // steal from the consumer with the most items not started
+      size_t victim = c;
+      for (size_t i = 0; i < _consumers.size(); ++i) {
+        if (_consumers[i].end - _consumers[i].begin > _consumers[victim].end - _consumers[victim].begin) {
+          victim = i;
+        }
+      }
+      consumer& v = _consumers[victim];
+      if (victim == c || v.end == v.begin) {
+        return false;
+      }
+      // a single item left is taken only when its owner is slower
+      const size_t left = v.end - v.begin;
+      if (left == 1 && !(me.cost && v.cost > me.cost)) {
+        return false;
+      }
+      const size_t mid = v.begin + left / 2;
+      me.begin = mid;
+      me.end = v.end;
+      v.end = mid;
+      me.report.stolen += me.end - me.begin;
+    }
+    item = me.begin++;
+    ++me.report.items;
+    return true;
+  }
+
+  // measured cost of one item processed by consumer c
+  void report(size_t c, double seconds)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    consumer& me = _consumers[c];
+    seconds = std::max(seconds, 1e-9);
+    me.cost = me.cost == 0 ? seconds : (1 - _smoothing) * me.cost + _smoothing * seconds;
+    me.report.seconds_per_item = me.cost;
+  }
+
+  cl_balance_report summary(size_t c)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _consumers[c].report;
+  }
+};
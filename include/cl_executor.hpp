@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cl_autotune.hpp"
+#include "cl_balancer.hpp"
+#include "cl_host_memory.hpp"
+#include "cl_pipeline.hpp"
+#include "cl_runtime.hpp"
+
+// Runs a batch of items (images) over every device of a cl_runtime and,
+// optionally, over the host itself.
+//
+// There is one host thread per device and each one owns a kernel object
+// of its own: OpenCL kernels keep their arguments, so threads must never
+// call clSetKernelArg on a shared cl_kernel. Each thread streams its items
+// through its device with cl_stream_from (separate upload, compute and
+// download queues, a ring of buffers).
+//
+// Items are not split in advance, the devices pull them from a cl_balancer
+// (adaptive chunks, stealing at the tail). The cost of an item on a device
+// is measured with event profiling: with the three stages overlapped, a
+// device finishes one item per max(upload, compute, download). The host
+// "device" runs host_run(item) on the calling thread, which can use a
+// thread pool of its own, and is measured with the wall clock.
+//
+// The work-group shape can be set per device with the result of
+// cl_autotune for it (set_tuning); the global size is then rounded up to a
+// multiple of the shape on that device.
+//
+// load, store and host_run are called from several threads at the same
+// time, for different items.
+
+struct cl_executor_report
+{
+  std::string name;
+  cl_pipeline_stats stats;    // empty for the host
+  cl_balance_report balance;
+};
+
+// host_run of a run without host device
+struct cl_executor_no_host
+{
+  void operator()(size_t) const {}
+};
+
+class cl_executor
+{
+  cl_runtime& _runtime;
+  cl_program _program;
+  std::string _kernel;
+  size_t _depth;
+  std::vector<cl_tuning> _tuning;  // per device
+  std::vector<bool> _tuned;
+
+  public:
+  cl_executor(cl_runtime& runtime, cl_program program, const std::string& kernel, size_t depth = 3)
+      : _runtime(runtime), _program(program), _kernel(kernel), _depth(depth)
+  {}
+
+  // work-group shape of a device, instead of the local of run()
+  void set_tuning(size_t device, const cl_tuning& tuning)
+  {
+    _tuning.resize(_runtime.size());
+    _tuned.resize(_runtime.size());
+    _tuning[device] = tuning;
+    _tuned[device] = true;
+  }
+
+  // per device reports, in the order of the devices of the runtime
+  template<typename Load, typename SetArgs, typename Store>
+  std::vector<cl_executor_report> run(size_t items, size_t bytes, cl_uint dims, const size_t* global,
+                                      const size_t* local, Load load, SetArgs set_args, Store store)
+  {
+    return run(items, bytes, dims, global, local, load, set_args, store, cl_executor_no_host(), false);
+  }
+
+  // the same with the host as one more consumer, reported last
+  template<typename Load, typename SetArgs, typename Store, typename HostRun>
+  std::vector<cl_executor_report> run(size_t items, size_t bytes, cl_uint dims, const size_t* global,
+                                      const size_t* local, Load load, SetArgs set_args, Store store,
+                                      HostRun host_run, bool use_host = true)
+  {
+    const size_t devices = _runtime.size();
+    cl_balancer balancer(items, devices + (use_host ? 1 : 0));
+    std::vector<cl_executor_report> reports(devices + (use_host ? 1 : 0));
+
+    std::vector<std::thread> threads;
+    for (size_t d = 0; d < devices; ++d) {
+      threads.push_back(std::thread([&, d] {
+          cl_kernel_ref kernel = _runtime.kernel(_program, _kernel);
+          reports[d].name = _runtime.device(d).name;
+          std::vector<size_t> device_global(global, global + dims);
+          const size_t* device_local = local;
+          if (d < _tuned.size() && _tuned[d]) {
+            device_global = _tuning[d].global_size(dims, global);
+            device_local = _tuning[d].local_size();
+          }
+          reports[d].stats = cl_stream_from(_runtime, d, kernel.get(), bytes, _depth,
+              cl_best_transfer(_runtime.device(d)), dims, device_global.data(), device_local,
+              [&](size_t& item) { return balancer.next(d, item); },
+              load, set_args, store,
+              [&](size_t, double upload, double compute, double download) {
+                balancer.report(d, std::max(compute, std::max(upload, download)));
+              });
+      }));
+    }
+    if (use_host) {
+      reports[devices].name = "host";
+      size_t item;
+      while (balancer.next(devices, item)) {
+        auto start = std::chrono::steady_clock::now();
+        host_run(item);
+        balancer.report(devices, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      }
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    for (size_t c = 0; c < reports.size(); ++c) {
+      reports[c].balance = balancer.summary(c);
+    }
+    return reports;
+  }
+};
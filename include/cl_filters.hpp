@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cl_runtime.hpp"
+
+// OpenCL counterparts of CImg's image filters, kernels in kernel_filters.cl:
+//  - convolve: CImg::get_convolve(mask), Neumann boundaries, tiled through
+//    local memory
+//  - gaussian: separable Gaussian blur, two 1D convolutions
+//  - blur: CImg::get_blur(sigma, 1, false), the recursive Deriche filter,
+//    one line per work-item
+//  - resize: CImg::get_resize(w, h, -100, -100, 3 or 5), linear or cubic
+//  - rotate: CImg::get_rotate(angle), linear, Dirichlet boundaries
+//  - histogram: CImg::get_histogram(levels, vmin, vmax), local histograms
+//    per work-group reduced by a second kernel
+//
+// Images are float, in CImg's planar layout, and stay on the device
+// between filters (cl_image), so a chain of filters uploads and downloads
+// once. Everything runs in order on one queue of one device; seconds()
+// is the kernel time of the last filter.
+//
+// CImg computes in double in a few places (Deriche recursion, resize
+// weights) and sums in another order, so results match CImg within float
+// rounding; the histogram of an integer valued image matches exactly.
+// resize interpolates when shrinking too, while CImg averages blocks of
+// pixels there.
+
+// float planar image on a device
+struct cl_image
+{
+  cl_buffer buffer;
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned int planes = 0;
+
+  size_t size() const { return (size_t)width * height * planes; }
+};
+
+inline cl_image cl_make_image(cl_runtime& runtime, unsigned int width, unsigned int height, unsigned int planes)
+{
+  cl_image img;
+  img.width = width;
+  img.height = height;
+  img.planes = planes;
+  img.buffer = runtime.buffer(CL_MEM_READ_WRITE, std::max<size_t>(1, img.size()) * sizeof(float));
+  return img;
+}
+
+// CImg's mask centers for get_convolve; masks of at most 5x5, not 1D,
+// are padded to an odd square first, which moves the center of even sizes
+inline void cl_mask_center(unsigned int mask_width, unsigned int mask_height, cl_int& center_x, cl_int& center_y)
+{
+  center_x = mask_width / 2 - 1 + mask_width % 2;
+  center_y = mask_height / 2 - 1 + mask_height % 2;
+  if (mask_width > 1 && mask_height > 1 && mask_width <= 5 && mask_height <= 5) {
+    center_x = center_y = std::max(mask_width, mask_height) / 2;
+  }
+}
+
+enum class cl_interpolation { linear, cubic };
+
+class cl_filters
+{
+  cl_runtime& _runtime;
+  size_t _device;
+  cl_program _program;
+  cl_kernel_ref _convolve;
+  cl_kernel_ref _deriche;
+  cl_kernel_ref _resize_rows;
+  cl_kernel_ref _resize_columns;
+  cl_kernel_ref _rotate;
+  cl_kernel_ref _histogram_partial;
+  cl_kernel_ref _histogram_reduce;
+  std::vector<cl_event_ref> _events;  // kernels of the last filter
+
+  cl_command_queue queue() { return _runtime.queue(_device); }
+
+  size_t max_group(cl_kernel kernel)
+  {
+    size_t max = 0;
+    cl_error(clGetKernelWorkGroupInfo(kernel, _runtime.device(_device).id, CL_KERNEL_WORK_GROUP_SIZE,
+                                      sizeof(size_t), &max, NULL),
+             "Failed to get kernel work group info");
+    return max;
+  }
+
+  // global rounded up to a multiple of local
+  void launch(cl_kernel kernel, cl_uint dims, const size_t* global, const size_t* local = NULL)
+  {
+    size_t rounded[3];
+    for (cl_uint i = 0; i < dims; ++i) {
+      rounded[i] = local ? (global[i] + local[i] - 1) / local[i] * local[i] : global[i];
+    }
+    _events.push_back(cl_launch(queue(), kernel, dims, rounded, local));
+  }
+
+  void begin() { _events.clear(); }
+
+  public:
+  cl_filters(cl_runtime& runtime, const std::string& path = "kernel_filters.cl", size_t device = 0)
+      : _runtime(runtime), _device(device), _program(runtime.program(path))
+  {
+    _convolve = runtime.kernel(_program, "convolve_tiled");
+    _deriche = runtime.kernel(_program, "deriche_lines");
+    _resize_rows = runtime.kernel(_program, "resize_rows");
+    _resize_columns = runtime.kernel(_program, "resize_columns");
+    _rotate = runtime.kernel(_program, "rotate_linear");
+    _histogram_partial = runtime.kernel(_program, "histogram_partial");
+    _histogram_reduce = runtime.kernel(_program, "histogram_reduce");
+  }
+
+  // kernel time of the last filter, waits for it
+  double seconds()
+  {
+    double total = 0;
+    for (const auto& e : _events) {
+      cl_wait(e);
+      total += cl_event_seconds(e.get());
+    }
+    return total;
+  }
+
+  cl_image image(unsigned int width, unsigned int height, unsigned int planes)
+  {
+    return cl_make_image(_runtime, width, height, planes);
+  }
+
+  // mask: mask_width * mask_height weights, row by row
+  cl_image convolve(const cl_image& in, const std::vector<float>& mask, unsigned int mask_width,
+                    unsigned int mask_height)
+  {
+    begin();
+    cl_image out = image(in.width, in.height, in.planes);
+    cl_buffer weights = _runtime.buffer(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mask.size() * sizeof(float),
+                                        const_cast<float*>(mask.data()));
+
+    cl_int center_x, center_y;
+    cl_mask_center(mask_width, mask_height, center_x, center_y);
+
+    // 16 x 16 work-groups, flatter ones if the kernel allows fewer items
+    size_t local[3] = { 16, std::max<size_t>(1, std::min<size_t>(16, max_group(_convolve.get()) / 16)), 1 };
+    size_t tile = (local[0] + mask_width - 1) * (local[1] + mask_height - 1) * sizeof(float);
+    if (tile > _runtime.device(_device).local_mem) {
+      printf("A %ux%u mask needs %zu B of local memory, the device has %llu B\n", mask_width, mask_height, tile,
+             (unsigned long long)_runtime.device(_device).local_mem);
+      exit(-1);
+    }
+    cl_set_args(_convolve.get(), in.buffer, out.buffer, weights, in.width, in.height, mask_width, mask_height,
+                center_x, center_y, cl_local{ tile });
+    size_t global[3] = { in.width, in.height, in.planes };
+    launch(_convolve.get(), 3, global, local);
+    return out;
+  }
+
+  // 1D Gaussian of radius ceil(3 sigma) along x, then along y
+  cl_image gaussian(const cl_image& in, float sigma)
+  {
+    const int radius = std::max(1, (int)std::ceil(3 * sigma));
+    std::vector<float> mask(2 * radius + 1);
+    float sum = 0;
+    for (int i = -radius; i <= radius; ++i) {
+      sum += mask[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+    }
+    for (auto& w : mask) {
+      w /= sum;
+    }
+    cl_image rows = convolve(in, mask, mask.size(), 1);
+    std::vector<cl_event_ref> events = _events;
+    cl_image out = convolve(rows, mask, 1, mask.size());
+    _events.insert(_events.begin(), events.begin(), events.end());
+    return out;
+  }
+
+  // recursive Deriche blur along x, then along y
+  cl_image blur(const cl_image& in, float sigma)
+  {
+    begin();
+    const double
+      nsigma = sigma < 0.1f ? 0.1f : sigma,
+      alpha = 1.695f / nsigma,
+      ema = std::exp(-alpha),
+      ema2 = std::exp(-2 * alpha),
+      b1 = -2 * ema,
+      b2 = ema2,
+      k = (1 - ema) * (1 - ema) / (1 + 2 * alpha * ema - ema2),
+      a0 = k,
+      a1 = k * (alpha - 1) * ema,
+      a2 = k * (alpha + 1) * ema,
+      a3 = -k * ema2;
+    const double coefficients[8] = { a0, a1, a2, a3, b1, b2, (a0 + a1) / (1 + b1 + b2), (a2 + a3) / (1 + b1 + b2) };
+    cl_float8 c;
+    for (size_t i = 0; i < 8; ++i) {
+      c.s[i] = (cl_float)coefficients[i];
+    }
+
+    const unsigned int w = in.width, h = in.height, plane = w * h;
+    cl_image out = image(w, h, in.planes);
+    if (sigma < 0.1f || (w == 1 && h == 1)) {
+      // as CImg, no blur at all
+      cl_error(clEnqueueCopyBuffer(queue(), in.buffer.get(), out.buffer.get(), 0, 0, in.size() * sizeof(float), 0,
+                                   NULL, NULL),
+               "Failed to enqueue a copy command");
+      return out;
+    }
+    cl_image rows = image(w, h, in.planes);
+    const cl_image* src = &in;
+    if (w > 1) {
+      size_t lines = (size_t)h * in.planes;
+      cl_set_args(_deriche.get(), in.buffer, rows.buffer, w, 1u, h, w, plane, (unsigned int)lines, c);
+      launch(_deriche.get(), 1, &lines);
+      src = &rows;
+    }
+    if (h > 1) {
+      size_t lines = (size_t)w * in.planes;
+      cl_set_args(_deriche.get(), src->buffer, out.buffer, h, w, w, 1u, plane, (unsigned int)lines, c);
+      launch(_deriche.get(), 1, &lines);
+      return out;
+    }
+    return *src;
+  }
+
+  // x pass, then y pass, each one skipped when its size does not change
+  cl_image resize(const cl_image& in, unsigned int width, unsigned int height,
+                  cl_interpolation interpolation = cl_interpolation::linear)
+  {
+    begin();
+    const cl_uint cubic = interpolation == cl_interpolation::cubic;
+    cl_image current = in;
+    if (width != in.width) {
+      cl_image rows = image(width, in.height, in.planes);
+      cl_float scale = width > 1 ? (cl_float)((in.width - 1.) / (width - 1)) : 0;
+      cl_set_args(_resize_rows.get(), current.buffer, rows.buffer, in.width, width, in.height * in.planes, scale,
+                  cubic);
+      size_t global[2] = { width, (size_t)in.height * in.planes };
+      launch(_resize_rows.get(), 2, global);
+      current = rows;
+    }
+    if (height != in.height) {
+      cl_image columns = image(width, height, in.planes);
+      cl_float scale = height > 1 ? (cl_float)((in.height - 1.) / (height - 1)) : 0;
+      cl_set_args(_resize_columns.get(), current.buffer, columns.buffer, width, in.height, height, scale, cubic);
+      size_t global[3] = { width, height, in.planes };
+      launch(_resize_columns.get(), 3, global);
+      current = columns;
+    }
+    return current;
+  }
+
+  // the output is the bounding box of the rotated image, as in CImg
+  cl_image rotate(const cl_image& in, float angle)
+  {
+    begin();
+    const float nangle = angle - 360 * std::floor(angle / 360);
+    const double rad = nangle * M_PI / 180;
+    float ca = (float)std::cos(rad), sa = (float)std::sin(rad);
+    if (std::fmod(nangle, 90.f) == 0) {
+      // exact quarter turns, as CImg which moves the pixels there
+      const int quarter = (int)nangle / 90;
+      ca = quarter == 0 ? 1 : quarter == 2 ? -1 : 0;
+      sa = quarter == 1 ? 1 : quarter == 3 ? -1 : 0;
+    }
+    const unsigned int w = in.width, h = in.height;
+    const unsigned int out_width = (unsigned int)std::round(1 + std::fabs((w - 1) * ca) + std::fabs((h - 1) * sa));
+    const unsigned int out_height = (unsigned int)std::round(1 + std::fabs((w - 1) * sa) + std::fabs((h - 1) * ca));
+    cl_image out = image(out_width, out_height, in.planes);
+
+    cl_float4 rotation;
+    rotation.s[0] = ca;
+    rotation.s[1] = sa;
+    rotation.s[2] = 0.5f * (w - 1);
+    rotation.s[3] = 0.5f * (h - 1);
+    cl_float2 out_center;
+    out_center.s[0] = 0.5f * (out_width - 1);
+    out_center.s[1] = 0.5f * (out_height - 1);
+    cl_set_args(_rotate.get(), in.buffer, out.buffer, w, h, out_width, out_height, rotation, out_center);
+    size_t global[3] = { out_width, out_height, in.planes };
+    launch(_rotate.get(), 3, global);
+    return out;
+  }
+
+  std::vector<uint32_t> histogram(const cl_image& in, unsigned int levels, float vmin, float vmax)
+  {
+    begin();
+    if (vmin > vmax) {
+      std::swap(vmin, vmax);
+    }
+    if (levels == 0 || vmin == vmax) {
+      printf("A histogram needs levels and a range, got %u levels in [%f, %f]\n", levels, vmin, vmax);
+      exit(-1);
+    }
+    const cl_device_desc& d = _runtime.device(_device);
+    const size_t counts = levels * sizeof(cl_uint);
+    if (counts > d.local_mem) {
+      printf("A histogram of %u levels needs %zu B of local memory, the device has %llu B\n", levels, counts,
+             (unsigned long long)d.local_mem);
+      exit(-1);
+    }
+
+    // a few groups per compute unit, each one striding over the image
+    size_t local = std::min<size_t>(256, max_group(_histogram_partial.get()));
+    size_t groups = std::max<size_t>(1, std::min<size_t>(4 * d.compute_units, (in.size() + local - 1) / local));
+    size_t global = groups * local;
+    cl_buffer partial = _runtime.buffer(CL_MEM_READ_WRITE, groups * counts);
+    cl_buffer result = _runtime.buffer(CL_MEM_WRITE_ONLY, counts);
+    cl_set_args(_histogram_partial.get(), in.buffer, (cl_uint)in.size(), levels, vmin, vmax, partial,
+                cl_local{ counts });
+    launch(_histogram_partial.get(), 1, &global, &local);
+
+    size_t buckets = levels;
+    cl_set_args(_histogram_reduce.get(), partial, (cl_uint)groups, levels, result);
+    launch(_histogram_reduce.get(), 1, &buckets);
+
+    std::vector<uint32_t> histogram(levels);
+    result.read(queue(), histogram.data(), true);
+    return histogram;
+  }
+
+#ifdef cimg_version
+  cl_image upload(const cimg_library::CImg<float>& img)
+  {
+    cl_image out = image(img.width(), img.height() * img.depth(), img.spectrum());
+    out.buffer.write(queue(), img.data(), true);
+    return out;
+  }
+
+  cimg_library::CImg<float> download(const cl_image& in)
+  {
+    cimg_library::CImg<float> img(in.width, in.height, 1, in.planes);
+    in.buffer.read(queue(), img.data(), true);
+    return img;
+  }
+
+  cl_image convolve(const cl_image& in, const cimg_library::CImg<float>& mask)
+  {
+    return convolve(in, std::vector<float>(mask.begin(), mask.end()), mask.width(), mask.height());
+  }
+#endif
+};
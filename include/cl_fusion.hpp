@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cl_filters.hpp"
+#include "cl_runtime.hpp"
+
+// Kernel fusion for chains of point-wise and small-stencil operations on
+// float planar images (cl_image). Run one kernel per operation and every
+// intermediate image makes a round trip through global memory; cl_fusion
+// generates instead a single kernel computing the last image directly
+// from the first one, so an image is read once and written once whatever
+// the length of the chain.
+//
+// Every operation becomes a function value(x, y, c) of the image before
+// it, which it calls at the coordinates it needs: a flip calls it at the
+// mirrored pixel, a map at the same pixel, a convolution at each tap of
+// its mask (clamped to the image, Neumann boundaries as CImg), a channel
+// mix once per input channel. The constants (weights, matrices) are
+// written into the source, so the compiler folds them; the image size is
+// a kernel argument, so one program serves every size.
+//
+// Values are recomputed, not stored: a stencil following a stencil
+// evaluates the first one at every tap of the second. Fusion pays as long
+// as the chain holds one or two small stencils; split longer ones in
+// several pipelines.
+//
+// Programs go through cl_runtime::program_from_source, so the same chain
+// is built once per runtime and its binary is cached on disk under the
+// hash of its source.
+//
+// Global memory traffic is given two ways. cl_fusion::traffic is the
+// compulsory traffic, every byte of every image a kernel reads or writes
+// counted once: a lower bound from the sizes. cl_fused_kernel::count runs
+// instrumented kernels that count the loads and stores they issue: a
+// stencil reads each pixel once per tap (a 3x3 convolution 9 times, 27
+// with a grayscale after it when fused), and how much of that the caches
+// absorb depends on the device, so fusion can issue more loads than the
+// unfused chain.
+
+// bytes of global memory read and written per image
+struct cl_fusion_traffic
+{
+  size_t fused = 0;    // one kernel: the input once, the output once
+  size_t unfused = 0;  // one kernel per operation, with every intermediate image
+
+  double saving() const { return unfused ? 1 - (double)fused / unfused : 0; }
+};
+
+class cl_fusion
+{
+  struct stage
+  {
+    std::string name;
+    std::string body;     // computes the value at (x, y, c), calls prev(x, y, c)
+    unsigned int planes;  // planes of the output
+  };
+
+  unsigned int _planes;   // planes of the input
+  std::vector<stage> _stages;
+
+  static std::string literal(float value)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9ef", value);
+    return text;
+  }
+
+  // prev(...) of the body of stage i calls the function of stage i - 1
+  static std::string link(const std::string& body, size_t i, bool counted)
+  {
+    const std::string call = "stage" + std::to_string(i - 1) + (counted ? "(in, loads, " : "(in, ") + "width, height, ";
+    std::string linked;
+    size_t from = 0, at;
+    while ((at = body.find("prev(", from)) != std::string::npos) {
+      linked += body.substr(from, at - from) + call;
+      from = at + 5;
+    }
+    return linked + body.substr(from);
+  }
+
+  cl_fusion& add(const std::string& name, const std::string& body, unsigned int planes)
+  {
+    _stages.push_back(stage{ name, body, planes });
+    return *this;
+  }
+
+  public:
+  explicit cl_fusion(unsigned int planes) : _planes(planes) {}
+
+  unsigned int input_planes() const { return _planes; }
+  unsigned int planes(size_t stages) const { return stages ? _stages[stages - 1].planes : _planes; }
+  unsigned int output_planes() const { return planes(_stages.size()); }
+  size_t size() const { return _stages.size(); }
+  const std::string& name(size_t i) const { return _stages[i].name; }
+
+  // mirror along x, CImg::mirror('x')
+  cl_fusion& flip() { return add("flip", "return prev(width - 1 - x, y, c);", output_planes()); }
+
+  // point-wise OpenCL expression of the value v, and of x, y and c
+  cl_fusion& map(const std::string& expression)
+  {
+    return add("map " + expression, "float v = prev(x, y, c);\n  return " + expression + ";", output_planes());
+  }
+
+  // v * gain + offset
+  cl_fusion& scale(float gain, float offset = 0)
+  {
+    return map("v * " + literal(gain) + " + " + literal(offset));
+  }
+
+  // CImg::get_convolve(mask) with Neumann boundaries, mask row by row
+  cl_fusion& convolve(const std::vector<float>& mask, unsigned int mask_width, unsigned int mask_height)
+  {
+    cl_int center_x, center_y;
+    cl_mask_center(mask_width, mask_height, center_x, center_y);
+    std::string body = "float sum = 0;\n";
+    for (unsigned int j = 0; j < mask_height; ++j) {
+      for (unsigned int i = 0; i < mask_width; ++i) {
+        const float w = mask[j * mask_width + i];
+        if (w != 0) {
+          body += "  sum += " + literal(w) + " * prev(clamp(x + (" + std::to_string(center_x - (int)i) +
+                  "), 0, width - 1), clamp(y + (" + std::to_string(center_y - (int)j) + "), 0, height - 1), c);\n";
+        }
+      }
+    }
+    return add("convolve " + std::to_string(mask_width) + "x" + std::to_string(mask_height), body + "  return sum;",
+               output_planes());
+  }
+
+  // output channel o = sum_i matrix[o][i] * input channel i
+  cl_fusion& channels(const std::vector<std::vector<float>>& matrix)
+  {
+    std::string body;
+    for (size_t o = 0; o < matrix.size(); ++o) {
+      body += o ? "\n  " : "";
+      std::string sum;
+      for (size_t i = 0; i < matrix[o].size() && i < output_planes(); ++i) {
+        if (matrix[o][i] != 0) {
+          sum += (sum.empty() ? "" : " + ") + literal(matrix[o][i]) + " * prev(x, y, " + std::to_string(i) + ")";
+        }
+      }
+      body += (o + 1 < matrix.size() ? "if (c == " + std::to_string(o) + ") " : "") +
+              std::string("return ") + (sum.empty() ? "0" : sum) + ";";
+    }
+    return add("channels " + std::to_string(output_planes()) + " to " + std::to_string(matrix.size()), body,
+               matrix.size());
+  }
+
+  // RGB to luma (ITU-R BT.601), one plane
+  cl_fusion& grayscale() { return channels({ { 0.299f, 0.587f, 0.114f } }); }
+
+  // program with kernel "fused" running the stages [begin, end):
+  // fused(in, out, width, height, planes), range (width, height, planes).
+  // `counted` adds an argument __global uint* counter: every work-item
+  // counts the loads of `in` it issues in a private counter and adds it to
+  // counter[0], and counts its store in counter[1]
+  std::string source(size_t begin, size_t end, bool counted = false) const
+  {
+    const std::string params = counted ? "(__global const float* in, uint* loads, const int width, const int height,\n"
+                                       : "(__global const float* in, const int width, const int height,\n";
+    std::string src = "// generated by cl_fusion:";
+    for (size_t s = begin; s < end; ++s) {
+      src += (s > begin ? "," : "") + std::string(" ") + _stages[s].name;
+    }
+    src += counted ? " (counted)" : "";
+    src += "\n\nfloat stage0" + params + "             const int x, const int y, const int c)\n{\n" +
+           (counted ? "  ++*loads;\n" : "") +
+           "  return in[((size_t)c * height + y) * width + x];\n}\n";
+    for (size_t s = begin; s < end; ++s) {
+      const std::string n = std::to_string(s - begin + 1);
+      src += "\nfloat stage" + n + params + "             const int x, const int y, const int c)\n{\n  " +
+             link(_stages[s].body, s - begin + 1, counted) + "\n}\n";
+    }
+    src += "\n__kernel void fused(\n"
+           "  __global const float* in,\n"
+           "  __global float* out,\n"
+           "  const int width,\n"
+           "  const int height,\n"
+           "  const int planes" + std::string(counted ? ",\n  __global uint* counter" : "") + "){\n\n"
+           "  int x = get_global_id(0);\n"
+           "  int y = get_global_id(1);\n"
+           "  int c = get_global_id(2);\n"
+           "  if (x < width && y < height && c < planes) {\n";
+    const std::string last = "stage" + std::to_string(end - begin);
+    if (counted) {
+      src += "    uint loads = 0;\n"
+             "    out[((size_t)c * height + y) * width + x] = " + last + "(in, &loads, width, height, x, y, c);\n"
+             "    atomic_add(&counter[0], loads);\n"
+             "    atomic_inc(&counter[1]);\n";
+    } else {
+      src += "    out[((size_t)c * height + y) * width + x] = " + last + "(in, width, height, x, y, c);\n";
+    }
+    src += "  }\n}\n";
+    return src;
+  }
+
+  std::string source() const { return source(0, _stages.size()); }
+
+  // compulsory traffic of the chain: a lower bound, not a measurement
+  cl_fusion_traffic traffic(unsigned int width, unsigned int height) const
+  {
+    const size_t plane = (size_t)width * height * sizeof(float);
+    cl_fusion_traffic t;
+    t.fused = (input_planes() + output_planes()) * plane;
+    for (size_t s = 0; s < _stages.size(); ++s) {
+      t.unfused += (planes(s) + planes(s + 1)) * plane;
+    }
+    return t;
+  }
+};
+
+// Runs a cl_fusion on one device, as one fused kernel or, to compare, as
+// one kernel per operation.
+class cl_fused_kernel
+{
+  cl_runtime& _runtime;
+  size_t _device;
+  cl_fusion _fusion;
+  cl_kernel_ref _fused;
+  cl_build_info _build;
+  std::vector<cl_kernel_ref> _stages;    // built on the first run_unfused
+  std::vector<cl_event_ref> _events;     // kernels of the last run
+  std::vector<cl_kernel_ref> _counted;   // built on the first count: fused, then every stage
+
+  cl_event_ref launch(cl_kernel kernel, const cl_image& in, const cl_image& out)
+  {
+    cl_int width = in.width, height = in.height, planes = out.planes;
+    cl_set_args(kernel, in.buffer, out.buffer, width, height, planes);
+    size_t global[3] = { in.width, in.height, out.planes };
+    return cl_launch(_runtime.queue(_device), kernel, 3, global, NULL);
+  }
+
+  // bytes loaded and stored by one counted kernel from in to out
+  size_t count_launch(cl_kernel kernel, const cl_image& in, const cl_image& out, cl_buffer& counter)
+  {
+    cl_command_queue queue = _runtime.queue(_device);
+    cl_uint counts[2] = { 0, 0 };
+    counter.write(queue, counts, true);
+    cl_int width = in.width, height = in.height, planes = out.planes;
+    cl_set_args(kernel, in.buffer, out.buffer, width, height, planes, counter);
+    size_t global[3] = { in.width, in.height, out.planes };
+    cl_wait(cl_launch(queue, kernel, 3, global, NULL));
+    counter.read(queue, counts, true);
+    return ((size_t)counts[0] + counts[1]) * sizeof(float);
+  }
+
+  void check(const cl_image& in) const
+  {
+    if (in.planes != _fusion.input_planes()) {
+      printf("The pipeline takes %u planes, the image has %u\n", _fusion.input_planes(), in.planes);
+      exit(-1);
+    }
+  }
+
+  public:
+  cl_fused_kernel(cl_runtime& runtime, const cl_fusion& fusion, size_t device = 0)
+      : _runtime(runtime), _device(device), _fusion(fusion)
+  {
+    cl_program program = runtime.program_from_source(fusion.source());
+    _build = runtime.last_build();
+    _fused = runtime.kernel(program, "fused");
+  }
+
+  // how the fused program was obtained: built, from disk or from memory
+  const cl_build_info& build() const { return _build; }
+
+  cl_image run(const cl_image& in)
+  {
+    check(in);
+    cl_image out = cl_make_image(_runtime, in.width, in.height, _fusion.output_planes());
+    _events.assign(1, launch(_fused.get(), in, out));
+    return out;
+  }
+
+  cl_image run_unfused(const cl_image& in)
+  {
+    check(in);
+    if (_stages.empty()) {
+      for (size_t s = 0; s < _fusion.size(); ++s) {
+        cl_program program = _runtime.program_from_source(_fusion.source(s, s + 1));
+        _stages.push_back(_runtime.kernel(program, "fused"));
+      }
+    }
+    _events.clear();
+    cl_image current = in;
+    for (size_t s = 0; s < _fusion.size(); ++s) {
+      cl_image next = cl_make_image(_runtime, in.width, in.height, _fusion.planes(s + 1));
+      _events.push_back(launch(_stages[s].get(), current, next));
+      current = next;
+    }
+    return current;
+  }
+
+  // global memory traffic of run() and run_unfused() on `in`, counted by
+  // instrumented copies of their kernels: every load and store issued,
+  // cache hits included (up to 2^32 of each per kernel)
+  cl_fusion_traffic count(const cl_image& in)
+  {
+    check(in);
+    if (_counted.empty()) {
+      cl_program program = _runtime.program_from_source(_fusion.source(0, _fusion.size(), true));
+      _counted.push_back(_runtime.kernel(program, "fused"));
+      for (size_t s = 0; s < _fusion.size(); ++s) {
+        program = _runtime.program_from_source(_fusion.source(s, s + 1, true));
+        _counted.push_back(_runtime.kernel(program, "fused"));
+      }
+    }
+    cl_buffer counter = _runtime.buffer(CL_MEM_READ_WRITE, 2 * sizeof(cl_uint));
+    cl_fusion_traffic t;
+    t.fused = count_launch(_counted[0].get(), in,
+                           cl_make_image(_runtime, in.width, in.height, _fusion.output_planes()), counter);
+    cl_image current = in;
+    for (size_t s = 0; s < _fusion.size(); ++s) {
+      cl_image next = cl_make_image(_runtime, in.width, in.height, _fusion.planes(s + 1));
+      t.unfused += count_launch(_counted[s + 1].get(), current, next, counter);
+      current = next;
+    }
+    return t;
+  }
+
+  // kernel time of the last run, waits for it
+  double seconds()
+  {
+    double total = 0;
+    for (const auto& e : _events) {
+      cl_wait(e);
+      total += cl_event_seconds(e.get());
+    }
+    return total;
+  }
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <unistd.h>
+
+#include "cl_runtime.hpp"
+
+// Host memory for OpenCL transfers, with three ways of moving it to and
+// from a device buffer:
+//  - copy: pageable host memory, clEnqueueWrite/ReadBuffer. The driver
+//    copies it through a pinned bounce buffer of its own.
+//  - pinned: a CL_MEM_ALLOC_HOST_PTR staging buffer kept mapped, so the
+//    pixels are written straight into memory the DMA engine can read and
+//    the copy is one transfer.
+//  - zero_copy: a CL_MEM_USE_HOST_PTR buffer over page aligned host
+//    memory. Uploading is unmapping it and downloading is mapping it: on
+//    CPU and integrated devices, which share memory with the host, the
+//    kernel works on the pixels in place and nothing is copied.
+//
+// cl_host_memory is page aligned and a multiple of 64 bytes, what the
+// implementations ask for to use a host pointer without copying.
+
+class cl_host_memory
+{
+  unsigned char* _data;
+  size_t _size;
+
+  public:
+  explicit cl_host_memory(size_t size = 0) : _data(nullptr), _size(size)
+  {
+    if (size == 0) {
+      return;
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    void* p = nullptr;
+    if (posix_memalign(&p, page, (size + 63) / 64 * 64) != 0) {
+      printf("Failed to allocate %zu B of page aligned host memory\n", size);
+      exit(-1);
+    }
+    _data = static_cast<unsigned char*>(p);
+  }
+  cl_host_memory(const cl_host_memory&) = delete;
+  cl_host_memory& operator=(const cl_host_memory&) = delete;
+  cl_host_memory(cl_host_memory&& other) : _data(other._data), _size(other._size)
+  {
+    other._data = nullptr;
+    other._size = 0;
+  }
+  cl_host_memory& operator=(cl_host_memory&& other)
+  {
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    return *this;
+  }
+  ~cl_host_memory() { free(_data); }
+
+  unsigned char* data() const { return _data; }
+  size_t size() const { return _size; }
+};
+
+inline void* cl_map(cl_command_queue queue, cl_mem mem, cl_map_flags flags, size_t size, bool blocking,
+                    cl_event_ref& event, const std::vector<cl_event>& wait = std::vector<cl_event>())
+{
+  cl_int err;
+  void* p = clEnqueueMapBuffer(queue, mem, blocking ? CL_TRUE : CL_FALSE, flags, 0, size, wait.size(),
+                               wait.empty() ? NULL : wait.data(), event.receive(), &err);
+  cl_error(err, "Failed to map a buffer");
+  return p;
+}
+
+inline cl_event_ref cl_unmap(cl_command_queue queue, cl_mem mem, void* p,
+                             const std::vector<cl_event>& wait = std::vector<cl_event>())
+{
+  cl_event_ref event;
+  cl_error(clEnqueueUnmapMemObject(queue, mem, p, wait.size(), wait.empty() ? NULL : wait.data(),
+                                   event.receive()),
+           "Failed to unmap a buffer");
+  return event;
+}
+
+enum class cl_transfer { copy, pinned, zero_copy };
+
+inline const char* cl_transfer_name(cl_transfer path)
+{
+  switch (path) {
+    case cl_transfer::copy: return "copy";
+    case cl_transfer::pinned: return "pinned";
+    case cl_transfer::zero_copy: return "zero-copy";
+  }
+  return "";
+}
+
+inline cl_transfer cl_parse_transfer(const std::string& name)
+{
+  for (cl_transfer path : { cl_transfer::copy, cl_transfer::pinned, cl_transfer::zero_copy }) {
+    if (name == cl_transfer_name(path)) {
+      return path;
+    }
+  }
+  printf("Unknown transfer path %s, expected copy, pinned or zero-copy\n", name.c_str());
+  exit(-1);
+}
+
+// zero-copy where the device shares memory with the host, pinned otherwise
+inline cl_transfer cl_best_transfer(const cl_device_desc& device)
+{
+  return device.unified_memory ? cl_transfer::zero_copy : cl_transfer::pinned;
+}
+
+// A device buffer and the host memory it is filled from and read back to.
+// Write the input at host(), upload(), run kernels on device(), then
+// download() and read the output at host() once its event completed.
+// With CImg, image() wraps host() as a shared image: load the input into
+// it and save the output from it, the pixels are never copied on the host.
+class cl_transfer_buffer
+{
+  cl_transfer _path;
+  size_t _size;
+  cl_queue_ref _queue;      // unmaps at destruction
+  cl_host_memory _host;     // copy and zero_copy
+  cl_buffer _staging;       // pinned
+  cl_buffer _device;
+  unsigned char* _mapped;   // pinned staging or zero_copy host, while mapped
+
+  public:
+  cl_transfer_buffer() : _path(cl_transfer::copy), _size(0), _mapped(nullptr) {}
+  cl_transfer_buffer(cl_runtime& runtime, cl_command_queue queue, cl_transfer path, size_t size)
+      : _path(path), _size(size), _queue(cl_share(queue)), _mapped(nullptr)
+  {
+    cl_event_ref event;
+    switch (path) {
+      case cl_transfer::copy:
+        _host = cl_host_memory(size);
+        _device = runtime.buffer(CL_MEM_READ_WRITE, size);
+        break;
+      case cl_transfer::pinned:
+        _staging = runtime.buffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+        _mapped = static_cast<unsigned char*>(cl_map(queue, _staging.get(), CL_MAP_READ | CL_MAP_WRITE, size,
+                                                     true, event));
+        _device = runtime.buffer(CL_MEM_READ_WRITE, size);
+        break;
+      case cl_transfer::zero_copy:
+        _host = cl_host_memory(size);
+        _device = runtime.buffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, _host.data());
+        _mapped = static_cast<unsigned char*>(cl_map(queue, _device.get(), CL_MAP_WRITE_INVALIDATE_REGION, size,
+                                                     true, event));
+        break;
+    }
+  }
+  cl_transfer_buffer(const cl_transfer_buffer&) = delete;
+  cl_transfer_buffer& operator=(const cl_transfer_buffer&) = delete;
+  cl_transfer_buffer(cl_transfer_buffer&& other) : _path(other._path), _size(other._size), _mapped(nullptr)
+  {
+    swap(other);
+  }
+  cl_transfer_buffer& operator=(cl_transfer_buffer&& other)
+  {
+    swap(other);
+    return *this;
+  }
+  ~cl_transfer_buffer()
+  {
+    if (_mapped) {
+      cl_mem mem = _path == cl_transfer::pinned ? _staging.get() : _device.get();
+      cl_unmap(_queue.get(), mem, _mapped);
+      clFinish(_queue.get());
+    }
+  }
+
+  void swap(cl_transfer_buffer& other)
+  {
+    std::swap(_path, other._path);
+    std::swap(_size, other._size);
+    std::swap(_queue, other._queue);
+    std::swap(_host, other._host);
+    std::swap(_staging, other._staging);
+    std::swap(_device, other._device);
+    std::swap(_mapped, other._mapped);
+  }
+
+  cl_transfer path() const { return _path; }
+  size_t size() const { return _size; }
+  cl_mem device() const { return _device.get(); }
+
+  // where the host reads and writes the data; for zero_copy it is only
+  // valid between download() and the next upload()
+  unsigned char* host() const { return _mapped ? _mapped : _host.data(); }
+
+#ifdef cimg_version
+  // a CImg sharing host(), valid as long as host() is; loading a file of
+  // the same size decodes it in place
+  template<typename T>
+  cimg_library::CImg<T> image(unsigned int width, unsigned int height, unsigned int depth = 1,
+                              unsigned int spectrum = 1) const
+  {
+    if ((size_t)width * height * depth * spectrum * sizeof(T) > _size) {
+      printf("Transfer buffer of %zu B is too small for the image\n", _size);
+      exit(-1);
+    }
+    return cimg_library::CImg<T>(reinterpret_cast<T*>(host()), width, height, depth, spectrum, true);
+  }
+#endif
+
+  cl_event_ref upload(cl_command_queue queue, bool blocking = false,
+                      const std::vector<cl_event>& wait = std::vector<cl_event>())
+  {
+    if (_path == cl_transfer::zero_copy) {
+      cl_event_ref event = cl_unmap(queue, _device.get(), _mapped, wait);
+      _mapped = nullptr;
+      if (blocking) {
+        cl_wait(event);
+      }
+      return event;
+    }
+    return _device.write(queue, host(), blocking, wait);
+  }
+
+  cl_event_ref download(cl_command_queue queue, bool blocking = false,
+                        const std::vector<cl_event>& wait = std::vector<cl_event>())
+  {
+    if (_path == cl_transfer::zero_copy) {
+      cl_event_ref event;
+      _mapped = static_cast<unsigned char*>(cl_map(queue, _device.get(), CL_MAP_READ | CL_MAP_WRITE, _size,
+                                                   blocking, event, wait));
+      return event;
+    }
+    return _device.read(queue, host(), blocking, wait);
+  }
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "cl_host_memory.hpp"
+#include "cl_runtime.hpp"
+
+// Streaming pipeline for batches of same sized items (images) on one
+// device. Uploads, kernels and downloads go to three different in-order
+// queues of the device, linked by events, so the transfer of item i + 1
+// and the download of item i - 1 overlap with the kernel of item i.
+//
+// There are `depth` slots, each one a cl_transfer_buffer (device buffer
+// plus its host memory, moved by copy, pinned or zero-copy transfers):
+// item i uses slot i % depth, and before the slot is reused the
+// download of item i - depth is waited for and handed to `store`. Device
+// memory is depth * bytes whatever the number of items; depth 2 is double
+// buffering, 3 triple buffering.
+//
+//   load(i, host)         fills the staging buffer of item i
+//   launch(kernel, mem)   sets the arguments of the kernel for buffer mem
+//   store(i, host)        consumes the result of item i
+//
+// Kernels are launched over `dims` dimensions with the given global and
+// local sizes (local may be NULL).
+
+struct cl_pipeline_stats
+{
+  size_t items = 0;
+  double upload = 0;    // sum of the profiled command times, seconds
+  double compute = 0;
+  double download = 0;
+  double wall = 0;      // from the first upload to the last store
+
+  // how much of the command time was hidden by overlapping
+  double overlap() const
+  {
+    double busy = upload + compute + download;
+    return busy > 0 ? 1 - wall / busy : 0;
+  }
+};
+
+// done(item, upload, compute, download) receives the profiled seconds of
+// every finished item
+struct cl_stream_no_done
+{
+  void operator()(size_t, double, double, double) const {}
+};
+
+// Items come from next(item), which returns false when there are no more:
+// several devices can pull from the same work queue (cl_executor.hpp).
+template<typename Next, typename Load, typename SetArgs, typename Store, typename Done = cl_stream_no_done>
+cl_pipeline_stats cl_stream_from(cl_runtime& runtime, size_t device, cl_kernel kernel, size_t bytes,
+                                 size_t depth, cl_transfer path, cl_uint dims, const size_t* global,
+                                 const size_t* local, Next next, Load load, SetArgs set_args, Store store,
+                                 Done done = Done())
+{
+  struct slot
+  {
+    cl_transfer_buffer buffer;
+    size_t item;
+    cl_event_ref upload, compute, download;
+  };
+
+  cl_pipeline_stats stats;
+  cl_command_queue upload_queue = runtime.queue(device, 0);
+  cl_command_queue compute_queue = runtime.queue(device, 1);
+  cl_command_queue download_queue = runtime.queue(device, 2);
+
+  std::vector<slot> ring(depth ? depth : 1);
+  for (auto& s : ring) {
+    s.buffer = cl_transfer_buffer(runtime, upload_queue, path, bytes);
+  }
+
+  // waits for the download of the slot and hands the result over
+  auto retire = [&](slot& s) {
+    cl_wait(s.download);
+    double upload = cl_event_seconds(s.upload.get());
+    double compute = s.compute ? cl_event_seconds(s.compute.get()) : 0;
+    double download = cl_event_seconds(s.download.get());
+    stats.upload += upload;
+    stats.compute += compute;
+    stats.download += download;
+    store(s.item, s.buffer.host());
+    done(s.item, upload, compute, download);
+    s.compute = cl_event_ref();
+    s.download = cl_event_ref();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  size_t i = 0, item;
+  for (; next(item); ++i) {
+    slot& s = ring[i % ring.size()];
+    if (s.download) {
+      retire(s);
+    }
+    s.item = item;
+    load(item, s.buffer.host());
+
+    s.upload = s.buffer.upload(upload_queue);
+    // arguments are captured when the kernel is enqueued; an empty range
+    // (e.g. a 1 pixel wide image to flip) has nothing to compute and is
+    // an enqueue error, so it is not launched
+    if (std::all_of(global, global + dims, [](size_t g) { return g > 0; })) {
+      set_args(kernel, s.buffer.device());
+      s.compute = cl_launch(compute_queue, kernel, dims, global, local, cl_wait_list({ s.upload }));
+    }
+    s.download = s.buffer.download(download_queue, false, cl_wait_list({ s.upload, s.compute }));
+
+    // submit now, the three queues are not flushed by waiting on each other
+    clFlush(upload_queue);
+    clFlush(compute_queue);
+    clFlush(download_queue);
+  }
+  stats.items = i;
+  // the last slots, oldest first
+  for (size_t k = 0; k < ring.size(); ++k) {
+    slot& s = ring[(i + k) % ring.size()];
+    if (s.download) {
+      retire(s);
+    }
+  }
+  stats.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// items 0 .. items - 1 in order
+template<typename Load, typename SetArgs, typename Store>
+cl_pipeline_stats cl_stream(cl_runtime& runtime, size_t device, cl_kernel kernel, size_t bytes,
+                            size_t items, size_t depth, cl_transfer path, cl_uint dims, const size_t* global,
+                            const size_t* local, Load load, SetArgs set_args, Store store)
+{
+  size_t i = 0;
+  auto next = [&](size_t& item) {
+    item = i;
+    return i++ < items;
+  };
+  return cl_stream_from(runtime, device, kernel, bytes, std::min(depth, items), path, dims, global, local,
+                        next, load, set_args, store);
+}
@@ -0,0 +1,766 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+  #include <OpenCL/opencl.h>
+#else
+  #ifndef CL_TARGET_OPENCL_VERSION
+    #define CL_TARGET_OPENCL_VERSION 220
+  #endif
+  #include <CL/cl.h>
+#endif
+
+// Small RAII layer over the OpenCL C API shared by the flip drivers of
+// Laboratory-5 and Laboratory-6:
+//  - cl_ref<T>: reference counted handle (retain on copy, release on drop)
+//  - cl_discover_devices / cl_print_devices: platform and device scan
+//  - cl_runtime: one context over a set of devices of a platform, a pool
+//    of profiling queues per device and a cache of built programs
+//  - on-disk program binaries, so later runs skip the source build
+//  - cl_buffer: a cl_mem with its size and blocking/non-blocking copies
+//  - cl_event_seconds / cl_bandwidth: event profiling helpers
+//
+// Errors are reported like the drivers always did: print the code and a
+// message, then exit. Kernels are never shared: cl_runtime::kernel returns
+// a new instance each time, so threads and devices can set arguments
+// without racing.
+//
+// Everything works on any conformant implementation, including CPU only
+// ones such as pocl; pass CL_DEVICE_TYPE_CPU to cl_discover_devices or
+// select a CPU device by index.
+
+// check error, in such a case, it exits
+inline void cl_error(cl_int code, const char *string)
+{
+  if (code != CL_SUCCESS) {
+    printf("%d - %s\n", code, string);
+    exit(-1);
+  }
+}
+
+inline cl_int cl_retain(cl_device_id h) { return clRetainDevice(h); }
+inline cl_int cl_release(cl_device_id h) { return clReleaseDevice(h); }
+inline cl_int cl_retain(cl_context h) { return clRetainContext(h); }
+inline cl_int cl_release(cl_context h) { return clReleaseContext(h); }
+inline cl_int cl_retain(cl_command_queue h) { return clRetainCommandQueue(h); }
+inline cl_int cl_release(cl_command_queue h) { return clReleaseCommandQueue(h); }
+inline cl_int cl_retain(cl_program h) { return clRetainProgram(h); }
+inline cl_int cl_release(cl_program h) { return clReleaseProgram(h); }
+inline cl_int cl_retain(cl_kernel h) { return clRetainKernel(h); }
+inline cl_int cl_release(cl_kernel h) { return clReleaseKernel(h); }
+inline cl_int cl_retain(cl_mem h) { return clRetainMemObject(h); }
+inline cl_int cl_release(cl_mem h) { return clReleaseMemObject(h); }
+inline cl_int cl_retain(cl_event h) { return clRetainEvent(h); }
+inline cl_int cl_release(cl_event h) { return clReleaseEvent(h); }
+
+// Owns one reference to an OpenCL object. The constructor adopts the
+// reference returned by a clCreate* call.
+template<typename T>
+class cl_ref
+{
+  T _handle;
+
+  public:
+  cl_ref() : _handle(nullptr) {}
+  explicit cl_ref(T handle) : _handle(handle) {}
+  cl_ref(const cl_ref& other) : _handle(other._handle)
+  {
+    if (_handle) {
+      cl_retain(_handle);
+    }
+  }
+  cl_ref(cl_ref&& other) : _handle(other._handle) { other._handle = nullptr; }
+  cl_ref& operator=(cl_ref other)
+  {
+    std::swap(_handle, other._handle);
+    return *this;
+  }
+  ~cl_ref()
+  {
+    if (_handle) {
+      cl_release(_handle);
+    }
+  }
+
+  T get() const { return _handle; }
+  explicit operator bool() const { return _handle != nullptr; }
+
+  // drops the current reference and returns the slot to be filled by an
+  // output argument, e.g. the event of a clEnqueue* call
+  T* receive()
+  {
+    *this = cl_ref();
+    return &_handle;
+  }
+};
+
+// a new reference to a handle owned by someone else
+template<typename T>
+cl_ref<T> cl_share(T handle)
+{
+  if (handle) {
+    cl_retain(handle);
+  }
+  return cl_ref<T>(handle);
+}
+
+using cl_context_ref = cl_ref<cl_context>;
+using cl_queue_ref = cl_ref<cl_command_queue>;
+using cl_program_ref = cl_ref<cl_program>;
+using cl_kernel_ref = cl_ref<cl_kernel>;
+using cl_mem_ref = cl_ref<cl_mem>;
+using cl_event_ref = cl_ref<cl_event>;
+
+// ################################ DEVICES ################################
+
+inline std::string cl_platform_string(cl_platform_id platform, cl_platform_info param)
+{
+  size_t size = 0;
+  cl_error(clGetPlatformInfo(platform, param, 0, NULL, &size), "Error: Failed to get info of the platform");
+  std::string value(size, '\0');
+  cl_error(clGetPlatformInfo(platform, param, size, &value[0], NULL), "Error: Failed to get info of the platform");
+  return value.c_str();
+}
+
+inline std::string cl_device_string(cl_device_id device, cl_device_info param)
+{
+  size_t size = 0;
+  cl_error(clGetDeviceInfo(device, param, 0, NULL, &size), "clGetDeviceInfo: Getting device string");
+  std::string value(size, '\0');
+  cl_error(clGetDeviceInfo(device, param, size, &value[0], NULL), "clGetDeviceInfo: Getting device string");
+  return value.c_str();
+}
+
+template<typename T>
+T cl_device_value(cl_device_id device, cl_device_info param)
+{
+  T value;
+  cl_error(clGetDeviceInfo(device, param, sizeof(value), &value, NULL), "clGetDeviceInfo: Getting device value");
+  return value;
+}
+
+struct cl_device_desc
+{
+  cl_platform_id platform;
+  cl_device_id id;
+  size_t platform_index;
+  size_t device_index;      // within its platform
+  std::string platform_name;
+  std::string platform_version;
+  std::string name;
+  std::string vendor;
+  std::string version;
+  std::string driver_version;
+  cl_device_type type;
+  cl_uint compute_units;
+  cl_ulong global_mem;
+  cl_ulong global_cache;
+  cl_ulong local_mem;
+  cl_ulong max_alloc;
+  size_t max_work_group_size;
+  size_t timer_resolution;  // ns
+  bool unified_memory;      // shares the memory of the host (CPU, iGPU)
+  cl_ref<cl_device_id> sub_device;  // keeps a sub-device alive, empty for root devices
+};
+
+inline cl_device_desc cl_describe_device(cl_platform_id platform, cl_device_id id)
+{
+  cl_device_desc d;
+  d.platform = platform;
+  d.id = id;
+  d.platform_index = 0;
+  d.device_index = 0;
+  d.platform_name = cl_platform_string(platform, CL_PLATFORM_NAME);
+  d.platform_version = cl_platform_string(platform, CL_PLATFORM_VERSION);
+  d.name = cl_device_string(id, CL_DEVICE_NAME);
+  d.vendor = cl_device_string(id, CL_DEVICE_VENDOR);
+  d.version = cl_device_string(id, CL_DEVICE_VERSION);
+  d.driver_version = cl_device_string(id, CL_DRIVER_VERSION);
+  d.type = cl_device_value<cl_device_type>(id, CL_DEVICE_TYPE);
+  d.compute_units = cl_device_value<cl_uint>(id, CL_DEVICE_MAX_COMPUTE_UNITS);
+  d.global_mem = cl_device_value<cl_ulong>(id, CL_DEVICE_GLOBAL_MEM_SIZE);
+  d.global_cache = cl_device_value<cl_ulong>(id, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE);
+  d.local_mem = cl_device_value<cl_ulong>(id, CL_DEVICE_LOCAL_MEM_SIZE);
+  d.max_alloc = cl_device_value<cl_ulong>(id, CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+  d.max_work_group_size = cl_device_value<size_t>(id, CL_DEVICE_MAX_WORK_GROUP_SIZE);
+  d.timer_resolution = cl_device_value<size_t>(id, CL_DEVICE_PROFILING_TIMER_RESOLUTION);
+  d.unified_memory = cl_device_value<cl_bool>(id, CL_DEVICE_HOST_UNIFIED_MEMORY) == CL_TRUE ||
+                     (d.type & CL_DEVICE_TYPE_CPU);
+  return d;
+}
+
+// every device of the given type on every platform, in platform order
+inline std::vector<cl_device_desc> cl_discover_devices(cl_device_type type = CL_DEVICE_TYPE_ALL)
+{
+  cl_uint n_platforms = 0;
+  cl_error(clGetPlatformIDs(0, NULL, &n_platforms), "Error: Failed to Scan for Platforms IDs");
+  std::vector<cl_platform_id> platforms(n_platforms);
+  cl_error(clGetPlatformIDs(n_platforms, platforms.data(), NULL), "Error: Failed to Scan for Platforms IDs");
+
+  std::vector<cl_device_desc> devices;
+  for (size_t p = 0; p < platforms.size(); ++p) {
+    cl_uint n_devices = 0;
+    cl_int err = clGetDeviceIDs(platforms[p], type, 0, NULL, &n_devices);
+    if (err == CL_DEVICE_NOT_FOUND) {
+      continue;
+    }
+    cl_error(err, "Error: Failed to Scan for Devices IDs");
+    std::vector<cl_device_id> ids(n_devices);
+    cl_error(clGetDeviceIDs(platforms[p], type, n_devices, ids.data(), NULL), "Error: Failed to Scan for Devices IDs");
+    for (size_t d = 0; d < ids.size(); ++d) {
+      devices.push_back(cl_describe_device(platforms[p], ids[d]));
+      devices.back().platform_index = p;
+      devices.back().device_index = d;
+    }
+  }
+  return devices;
+}
+
+inline void cl_print_devices(const std::vector<cl_device_desc>& devices)
+{
+  for (const auto& d : devices) {
+    printf("\t[%zu]-Platform %s [%zu]-Device %s (%s)\n", d.platform_index, d.platform_name.c_str(),
+           d.device_index, d.name.c_str(), d.driver_version.c_str());
+    printf("\t\t compute units: %u, global mem: %llu B, global cache: %llu B, local mem: %llu B\n",
+           d.compute_units, (unsigned long long)d.global_mem, (unsigned long long)d.global_cache,
+           (unsigned long long)d.local_mem);
+    printf("\t\t max work group size: %zu, timer resolution: %zu ns, unified memory: %s\n\n",
+           d.max_work_group_size, d.timer_resolution, d.unified_memory ? "yes" : "no");
+  }
+}
+
+// device `device` of platform `platform`, as the drivers number them
+inline cl_device_desc cl_find_device(const std::vector<cl_device_desc>& devices, size_t platform,
+                                     size_t device)
+{
+  for (const auto& d : devices) {
+    if (d.platform_index == platform && d.device_index == device) {
+      return d;
+    }
+  }
+  printf("No device %zu on platform %zu\n", device, platform);
+  exit(-1);
+}
+
+// Splits a device, typically the CPU, into `parts` sub-devices with the
+// same number of compute units each (CL_DEVICE_PARTITION_EQUALLY). They
+// belong to the platform of the device, so one cl_runtime can hold them
+// and a multi-device executor can run on a single host.
+inline std::vector<cl_device_desc> cl_partition_equally(const cl_device_desc& device, cl_uint parts)
+{
+  parts = std::max<cl_uint>(1, std::min(parts, device.compute_units));
+  cl_device_partition_property properties[] = {
+    CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)(device.compute_units / parts), 0 };
+  cl_uint n = 0;
+  cl_error(clCreateSubDevices(device.id, properties, 0, NULL, &n), "Failed to partition the device");
+  std::vector<cl_device_id> ids(n);
+  cl_error(clCreateSubDevices(device.id, properties, n, ids.data(), NULL), "Failed to partition the device");
+
+  // with compute units not divisible by parts there are more sub-devices
+  // than asked for, the rest are released
+  std::vector<cl_device_desc> devices;
+  for (cl_uint i = 0; i < n; ++i) {
+    cl_ref<cl_device_id> ref(ids[i]);
+    if (i < parts) {
+      devices.push_back(cl_describe_device(device.platform, ids[i]));
+      devices.back().platform_index = device.platform_index;
+      devices.back().device_index = device.device_index;
+      devices.back().sub_device = ref;
+    }
+  }
+  return devices;
+}
+
+// ################################ EVENTS ################################
+
+inline cl_ulong cl_event_time(cl_event event, cl_profiling_info param)
+{
+  cl_ulong t = 0;
+  cl_error(clGetEventProfilingInfo(event, param, sizeof(cl_ulong), &t, NULL), "Failed to get profiling info");
+  return t;
+}
+
+// execution time of a finished command, queue with profiling enabled
+inline double cl_event_seconds(cl_event event)
+{
+  return (cl_event_time(event, CL_PROFILING_COMMAND_END) -
+          cl_event_time(event, CL_PROFILING_COMMAND_START)) * 1e-9;
+}
+
+// bandwidth = bytes passed / time spent passing them ==> B/s
+inline double cl_bandwidth(size_t bytes, cl_event event)
+{
+  return bytes / cl_event_seconds(event);
+}
+
+inline void cl_wait(const cl_event_ref& event)
+{
+  cl_event e = event.get();
+  cl_error(clWaitForEvents(1, &e), "Failed to wait for an event");
+}
+
+// raw handles of a list of events, for event wait lists
+inline std::vector<cl_event> cl_wait_list(const std::vector<cl_event_ref>& events)
+{
+  std::vector<cl_event> list;
+  for (const auto& e : events) {
+    if (e) {
+      list.push_back(e.get());
+    }
+  }
+  return list;
+}
+
+// ################################ BUFFERS ################################
+
+class cl_buffer
+{
+  cl_mem_ref _mem;
+  size_t _size;
+
+  public:
+  cl_buffer() : _size(0) {}
+  cl_buffer(cl_context context, cl_mem_flags flags, size_t size, void* host_ptr = NULL) : _size(size)
+  {
+    cl_int err;
+    _mem = cl_mem_ref(clCreateBuffer(context, flags, size, host_ptr, &err));
+    cl_error(err, "Failed to create memory buffer at device");
+  }
+
+  cl_mem get() const { return _mem.get(); }
+  size_t size() const { return _size; }
+
+  cl_event_ref write(cl_command_queue queue, const void* data, bool blocking = false,
+                     const std::vector<cl_event>& wait = std::vector<cl_event>()) const
+  {
+    cl_event_ref event;
+    cl_error(clEnqueueWriteBuffer(queue, get(), blocking ? CL_TRUE : CL_FALSE, 0, _size, data,
+                                  wait.size(), wait.empty() ? NULL : wait.data(), event.receive()),
+             "Failed to enqueue a write command");
+    return event;
+  }
+
+  cl_event_ref read(cl_command_queue queue, void* data, bool blocking = false,
+                    const std::vector<cl_event>& wait = std::vector<cl_event>()) const
+  {
+    cl_event_ref event;
+    cl_error(clEnqueueReadBuffer(queue, get(), blocking ? CL_TRUE : CL_FALSE, 0, _size, data,
+                                 wait.size(), wait.empty() ? NULL : wait.data(), event.receive()),
+             "Failed to enqueue a read command");
+    return event;
+  }
+};
+
+// ################################ KERNELS ################################
+
+template<typename T>
+void cl_set_arg(cl_kernel kernel, cl_uint index, const T& value)
+{
+  cl_error(clSetKernelArg(kernel, index, sizeof(T), &value), "Failed to set kernel argument");
+}
+
+inline void cl_set_arg(cl_kernel kernel, cl_uint index, const cl_buffer& buffer)
+{
+  cl_set_arg(kernel, index, buffer.get());
+}
+
+// a __local argument of `size` bytes, allocated per work-group
+struct cl_local
+{
+  size_t size;
+};
+
+inline void cl_set_arg(cl_kernel kernel, cl_uint index, const cl_local& local)
+{
+  cl_error(clSetKernelArg(kernel, index, local.size, NULL), "Failed to set kernel argument");
+}
+
+inline void cl_set_args_from(cl_kernel, cl_uint) {}
+
+template<typename T, typename... Args>
+void cl_set_args_from(cl_kernel kernel, cl_uint index, const T& value, const Args&... rest)
+{
+  cl_set_arg(kernel, index, value);
+  cl_set_args_from(kernel, index + 1, rest...);
+}
+
+// sets the arguments 0, 1, ... of kernel
+template<typename... Args>
+void cl_set_args(cl_kernel kernel, const Args&... args)
+{
+  cl_set_args_from(kernel, 0, args...);
+}
+
+// enqueues kernel over `dims` dimensions; local may be NULL
+inline cl_event_ref cl_launch(cl_command_queue queue, cl_kernel kernel, cl_uint dims,
+                              const size_t* global, const size_t* local,
+                              const std::vector<cl_event>& wait = std::vector<cl_event>())
+{
+  cl_event_ref event;
+  cl_error(clEnqueueNDRangeKernel(queue, kernel, dims, NULL, global, local, wait.size(),
+                                  wait.empty() ? NULL : wait.data(), event.receive()),
+           "Failed to launch kernel to the device");
+  return event;
+}
+
+// ################################ PROGRAM CACHE ################################
+//
+// clBuildProgram from source costs hundreds of ms, more than flipping an
+// image. Built programs are kept as CL_PROGRAM_BINARIES in one file per
+// device under the cache directory, named after a hash of everything the
+// binary depends on: the source, the build options, the device and the
+// driver. The full key, with the whole source, is stored in the file too,
+// so a hash collision or a driver update reads as a miss and the program
+// is built from source again.
+//
+// File layout: "cl_program_cache 1\n", key size, key, binary size, binary.
+
+// FNV-1a
+inline uint64_t cl_hash(const std::string& text, uint64_t h = 14695981039346656037ull)
+{
+  for (unsigned char c : text) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  return h;
+}
+
+inline std::string cl_hex(uint64_t value)
+{
+  char text[17];
+  snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+  return text;
+}
+
+inline std::string cl_binary_key(const std::string& source, const std::string& options,
+                                 const cl_device_desc& device)
+{
+  return "options " + options + "\n" +
+         "device " + device.name + "\n" +
+         "platform " + device.platform_name + " " + device.platform_version + "\n" +
+         "driver " + device.driver_version + "\n" +
+         "source " + std::to_string(source.size()) + "\n" + source;
+}
+
+inline std::string cl_binary_path(const std::string& dir, const std::string& key)
+{
+  return dir + "/" + cl_hex(cl_hash(key)) + ".clbin";
+}
+
+// the cached binary for key, empty on a miss
+inline std::vector<unsigned char> cl_load_binary(const std::string& dir, const std::string& key)
+{
+  std::ifstream file(cl_binary_path(dir, key), std::ios::in | std::ios::binary);
+  std::string magic, stored_key;
+  size_t key_size = 0, size = 0;
+  if (!std::getline(file, magic) || magic != "cl_program_cache 1" || !(file >> key_size) || file.get() != '\n') {
+    return std::vector<unsigned char>();
+  }
+  stored_key.resize(key_size);
+  if (!file.read(&stored_key[0], key_size) || stored_key != key || !(file >> size) || file.get() != '\n') {
+    return std::vector<unsigned char>();
+  }
+  std::vector<unsigned char> binary(size);
+  if (!file.read(reinterpret_cast<char*>(binary.data()), size)) {
+    return std::vector<unsigned char>();
+  }
+  return binary;
+}
+
+// written to a temporary file and renamed, so a concurrent run never
+// reads half a binary. A cache that cannot be written is not an error.
+inline void cl_store_binary(const std::string& dir, const std::string& key,
+                            const std::vector<unsigned char>& binary)
+{
+  mkdir(dir.c_str(), 0755);
+  const std::string path = cl_binary_path(dir, key);
+  const std::string tmp = path + ".tmp" + std::to_string((long long)getpid());
+  {
+    std::ofstream file(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+    file << "cl_program_cache 1\n" << key.size() << "\n" << key << binary.size() << "\n";
+    file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+    if (!file) {
+      remove(tmp.c_str());
+      return;
+    }
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+  }
+}
+
+// CL_PROGRAM_CACHE overrides the default directory, empty disables the cache
+inline std::string cl_default_cache_dir()
+{
+  const char* dir = getenv("CL_PROGRAM_CACHE");
+  return dir ? dir : ".cl_cache";
+}
+
+// how the last program()/program_from_source() call got its program
+struct cl_build_info
+{
+  double seconds = 0;       // creating and building, 0 for the in-memory cache
+  bool from_binary = false; // loaded from the on-disk cache
+  bool from_memory = false; // already built by this runtime
+};
+
+// ################################ RUNTIME ################################
+
+inline std::string cl_read_file(const std::string& path)
+{
+  std::ifstream file(path, std::ios::in | std::ios::binary);
+  if (!file) {
+    printf("Unable to open file %s\n", path.c_str());
+    exit(-1);
+  }
+  std::ostringstream source;
+  source << file.rdbuf();
+  return source.str();
+}
+
+// prints the whole build log of every device and exits
+inline void cl_build_failed(cl_program program, const std::vector<cl_device_id>& devices)
+{
+  printf("Error: Some error at building process.\n");
+  for (auto device : devices) {
+    size_t len = 0;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+    std::string log(len, '\0');
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, &log[0], NULL);
+    printf("%s\n", log.c_str());
+  }
+  exit(-1);
+}
+
+// One context over devices of the same platform. Queues and programs are
+// created on first use and shared; all members are thread safe. Programs
+// go through the on-disk binary cache unless its directory is empty.
+class cl_runtime
+{
+  std::vector<cl_device_desc> _devices;
+  std::vector<cl_device_id> _ids;
+  cl_context_ref _context;
+
+  std::mutex _mutex;
+  std::map<std::pair<size_t, size_t>, cl_queue_ref> _queues;     // (device, slot)
+  std::map<std::pair<std::string, std::string>, cl_program_ref> _programs;  // (source, options)
+  std::string _cache_dir;
+  cl_build_info _last_build;
+
+  public:
+  explicit cl_runtime(const std::vector<cl_device_desc>& devices)
+      : _devices(devices), _cache_dir(cl_default_cache_dir())
+  {
+    if (_devices.empty()) {
+      printf("No OpenCL device selected\n");
+      exit(-1);
+    }
+    for (const auto& d : _devices) {
+      if (d.platform != _devices[0].platform) {
+        printf("All the devices of a context must belong to the same platform\n");
+        exit(-1);
+      }
+      _ids.push_back(d.id);
+    }
+    cl_int err;
+    cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)_devices[0].platform, 0 };
+    _context = cl_context_ref(clCreateContext(properties, _ids.size(), _ids.data(), NULL, NULL, &err));
+    cl_error(err, "Failed to create a compute context");
+  }
+
+  cl_runtime(const cl_runtime&) = delete;
+  cl_runtime& operator=(const cl_runtime&) = delete;
+
+  cl_context context() const { return _context.get(); }
+  size_t size() const { return _devices.size(); }
+  const cl_device_desc& device(size_t i) const { return _devices[i]; }
+  const std::vector<cl_device_id>& device_ids() const { return _ids; }
+
+  std::string cache_dir()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cache_dir;
+  }
+
+  void set_cache_dir(const std::string& dir)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cache_dir = dir;
+  }
+
+  cl_build_info last_build()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _last_build;
+  }
+
+  // new in-order queue with profiling, plus any extra properties
+  cl_queue_ref new_queue(size_t device, cl_command_queue_properties extra = 0)
+  {
+    cl_int err;
+    cl_queue_properties properties[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE | extra, 0 };
+    cl_queue_ref queue(clCreateCommandQueueWithProperties(context(), _ids[device], properties, &err));
+    cl_error(err, "Failed to create a command queue");
+    return queue;
+  }
+
+  // queue number `slot` of a device from the pool
+  cl_command_queue queue(size_t device, size_t slot = 0)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& q = _queues[std::make_pair(device, slot)];
+    if (!q) {
+      q = new_queue(device);
+    }
+    return q.get();
+  }
+
+  // program built from source for every device of the context, cached by
+  // (source, options)
+  cl_program program_from_source(const std::string& source, const std::string& options = "")
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& p = _programs[std::make_pair(source, options)];
+    _last_build = cl_build_info();
+    _last_build.from_memory = bool(p);
+    if (!p) {
+      auto start = std::chrono::steady_clock::now();
+      p = build(source, options);
+      _last_build.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return p.get();
+  }
+
+  cl_program program(const std::string& path, const std::string& options = "")
+  {
+    return program_from_source(cl_read_file(path), options);
+  }
+
+  // what a program of this runtime was built from, hashed as in the binary
+  // cache key; empty for a program it did not build
+  std::string program_key(cl_program program)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto& p : _programs) {
+      if (p.second.get() == program) {
+        const std::string& source = p.first.first;
+        return "source " + cl_hex(cl_hash(source)) + " " + std::to_string(source.size()) + " options " +
+               p.first.second;
+      }
+    }
+    return "";
+  }
+
+  // a new kernel object: kernels hold their arguments, so every thread or
+  // device needs its own
+  cl_kernel_ref kernel(cl_program program, const std::string& name)
+  {
+    cl_int err;
+    cl_kernel_ref k(clCreateKernel(program, name.c_str(), &err));
+    cl_error(err, "Failed to create kernel from the program");
+    return k;
+  }
+
+  cl_buffer buffer(cl_mem_flags flags, size_t size, void* host_ptr = NULL)
+  {
+    return cl_buffer(context(), flags, size, host_ptr);
+  }
+
+  private:
+  // binaries of every device from the disk cache, or a null program
+  cl_program_ref load_binaries(const std::vector<std::string>& keys, const std::string& options)
+  {
+    std::vector<std::vector<unsigned char>> binaries;
+    for (const auto& key : keys) {
+      binaries.push_back(cl_load_binary(_cache_dir, key));
+      if (binaries.back().empty()) {
+        return cl_program_ref();
+      }
+    }
+    std::vector<size_t> sizes;
+    std::vector<const unsigned char*> pointers;
+    for (const auto& b : binaries) {
+      sizes.push_back(b.size());
+      pointers.push_back(b.data());
+    }
+    cl_int err;
+    std::vector<cl_int> status(_ids.size());
+    cl_program_ref program(clCreateProgramWithBinary(context(), _ids.size(), _ids.data(), sizes.data(),
+                                                     pointers.data(), status.data(), &err));
+    if (err != CL_SUCCESS || clBuildProgram(program.get(), _ids.size(), _ids.data(), options.c_str(), NULL, NULL) != CL_SUCCESS) {
+      return cl_program_ref();
+    }
+    return program;
+  }
+
+  void store_binaries(cl_program program, const std::vector<std::string>& keys)
+  {
+    cl_uint n = 0;
+    cl_error(clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(n), &n, NULL), "Failed to get program info");
+    std::vector<cl_device_id> ids(n);
+    std::vector<size_t> sizes(n);
+    cl_error(clGetProgramInfo(program, CL_PROGRAM_DEVICES, n * sizeof(cl_device_id), ids.data(), NULL),
+             "Failed to get program info");
+    cl_error(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, n * sizeof(size_t), sizes.data(), NULL),
+             "Failed to get program info");
+    std::vector<std::vector<unsigned char>> binaries(n);
+    std::vector<unsigned char*> pointers(n);
+    for (cl_uint i = 0; i < n; ++i) {
+      binaries[i].resize(sizes[i]);
+      pointers[i] = binaries[i].data();
+    }
+    cl_error(clGetProgramInfo(program, CL_PROGRAM_BINARIES, n * sizeof(unsigned char*), pointers.data(), NULL),
+             "Failed to get program info");
+    // the program lists its devices in its own order
+    for (cl_uint i = 0; i < n; ++i) {
+      for (size_t d = 0; d < _ids.size(); ++d) {
+        if (_ids[d] == ids[i] && !binaries[i].empty()) {
+          cl_store_binary(_cache_dir, keys[d], binaries[i]);
+        }
+      }
+    }
+  }
+
+  cl_program_ref build(const std::string& source, const std::string& options)
+  {
+    std::vector<std::string> keys;
+    for (const auto& d : _devices) {
+      keys.push_back(cl_binary_key(source, options, d));
+    }
+    if (!_cache_dir.empty()) {
+      cl_program_ref cached = load_binaries(keys, options);
+      if (cached) {
+        _last_build.from_binary = true;
+        return cached;
+      }
+    }
+
+    cl_int err;
+    const char* text = source.c_str();
+    cl_program_ref program(clCreateProgramWithSource(context(), 1, &text, NULL, &err));
+    cl_error(err, "Failed to create program with source");
+    err = clBuildProgram(program.get(), _ids.size(), _ids.data(), options.c_str(), NULL, NULL);
+    if (err != CL_SUCCESS) {
+      cl_build_failed(program.get(), _ids);
+    }
+    if (!_cache_dir.empty()) {
+      store_binaries(program.get(), keys);
+    }
+    return program;
+  }
+};
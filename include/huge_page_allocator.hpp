@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+// Allocator for large working arrays.
+//
+// Blocks of at least one huge page are aligned to 2 MiB and marked with
+// madvise(MADV_HUGEPAGE) so transparent huge pages can back them; smaller
+// blocks are aligned to a cache line. Elements are default initialized,
+// so a std::vector of floats is not zeroed by the allocating thread: the
+// pages are placed on the NUMA node of the thread that first writes them
+// (first touch), which should be the thread that later computes on them.
+
+constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+template<typename T>
+struct huge_page_allocator
+{
+  using value_type = T;
+
+  huge_page_allocator() = default;
+  template<typename U>
+  huge_page_allocator(const huge_page_allocator<U>&) {}
+
+  T* allocate(size_t n)
+  {
+    const size_t bytes = n * sizeof(T);
+    const bool huge = bytes >= huge_page_size;
+    const size_t alignment = huge ? huge_page_size : 64;
+    // round up so the last huge page is not shared with other data
+    const size_t size = (bytes + alignment - 1) / alignment * alignment;
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment, size) != 0) {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+      // only a hint: without THP support the regular pages are used
+      madvise(p, size, MADV_HUGEPAGE);
+    }
+#endif
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, size_t) { free(p); }
+
+  // value-initialization would touch every page from the allocating thread
+  template<typename U>
+  void construct(U* p) { ::new (static_cast<void*>(p)) U; }
+  template<typename U, typename... Args>
+  void construct(U* p, Args&&... args)
+  {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+};
+
+template<typename T, typename U>
+bool operator==(const huge_page_allocator<T>&, const huge_page_allocator<U>&) { return true; }
+template<typename T, typename U>
+bool operator!=(const huge_page_allocator<T>&, const huge_page_allocator<U>&) { return false; }
+
+template<typename T>
+using huge_vector = std::vector<T, huge_page_allocator<T>>;
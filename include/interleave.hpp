@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include <parallel_reduce.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define INTERLEAVE_SSSE3 1
+#include <immintrin.h>
+#endif
+
+// Conversion between CImg's planar layout (RRR...GGG...BBB...) and the
+// interleaved one (RGBRGBRGB...) for the few places that need it, e.g. a
+// JPEG encoder or a kernel written for interleaved pixels. The OpenCL flip
+// and filters work on the planar data directly, so the common path does
+// not convert at all.
+//
+// The image is split in blocks of pixels over threads. Three channel
+// 8-bit images, the usual case, go 16 pixels at a time through SSSE3
+// byte shuffles: every 16-byte vector of the output is the OR of one
+// shuffle of each of the three inputs. Other channel counts and types,
+// and every image off x86-64, use the scalar loop.
+
+struct interleave_options
+{
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t min_per_thread = 1 << 16;  // pixels, smaller images use fewer threads
+};
+
+template<typename T>
+void planar_to_interleaved_range(const T* planar, T* interleaved, size_t pixels, size_t channels,
+                                 size_t begin, size_t end)
+{
+  for (size_t p = begin; p < end; ++p) {
+    for (size_t c = 0; c < channels; ++c) {
+      interleaved[p * channels + c] = planar[c * pixels + p];
+    }
+  }
+}
+
+template<typename T>
+void interleaved_to_planar_range(const T* interleaved, T* planar, size_t pixels, size_t channels,
+                                 size_t begin, size_t end)
+{
+  for (size_t p = begin; p < end; ++p) {
+    for (size_t c = 0; c < channels; ++c) {
+      planar[c * pixels + p] = interleaved[p * channels + c];
+    }
+  }
+}
+
+#ifdef INTERLEAVE_SSSE3
+// pshufb masks for 16 pixels of 3 channels: to_interleaved[j][c] moves
+// channel c into output vector j, to_planar[c][j] moves the bytes of
+// channel c out of input vector j; 0x80 clears the byte
+struct interleave_masks
+{
+  alignas(16) uint8_t to_interleaved[3][3][16];
+  alignas(16) uint8_t to_planar[3][3][16];
+
+  interleave_masks()
+  {
+    for (size_t j = 0; j < 3; ++j) {
+      for (size_t c = 0; c < 3; ++c) {
+        for (size_t b = 0; b < 16; ++b) {
+          const size_t k = 16 * j + b;  // byte of the interleaved block
+          to_interleaved[j][c][b] = k % 3 == c ? uint8_t(k / 3) : 0x80;
+          const size_t from = 3 * b + c;  // byte holding pixel b of channel c
+          to_planar[c][j][b] = from / 16 == j ? uint8_t(from % 16) : 0x80;
+        }
+      }
+    }
+  }
+
+  static const interleave_masks& get()
+  {
+    static const interleave_masks masks;
+    return masks;
+  }
+};
+
+__attribute__((target("ssse3")))
+inline void planar_to_interleaved_rgb8_ssse3(const uint8_t* planar, uint8_t* interleaved, size_t pixels,
+                                             size_t begin, size_t end)
+{
+  const auto& m = interleave_masks::get();
+  size_t p = begin;
+  for (; p + 16 <= end; p += 16) {
+    __m128i in[3];
+    for (size_t c = 0; c < 3; ++c) {
+      in[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planar + c * pixels + p));
+    }
+    for (size_t j = 0; j < 3; ++j) {
+      __m128i out = _mm_setzero_si128();
+      for (size_t c = 0; c < 3; ++c) {
+        out = _mm_or_si128(out, _mm_shuffle_epi8(in[c], _mm_load_si128(
+                                  reinterpret_cast<const __m128i*>(m.to_interleaved[j][c]))));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(interleaved + 3 * p + 16 * j), out);
+    }
+  }
+  planar_to_interleaved_range(planar, interleaved, pixels, 3, p, end);
+}
+
+__attribute__((target("ssse3")))
+inline void interleaved_to_planar_rgb8_ssse3(const uint8_t* interleaved, uint8_t* planar, size_t pixels,
+                                             size_t begin, size_t end)
+{
+  const auto& m = interleave_masks::get();
+  size_t p = begin;
+  for (; p + 16 <= end; p += 16) {
+    __m128i in[3];
+    for (size_t j = 0; j < 3; ++j) {
+      in[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(interleaved + 3 * p + 16 * j));
+    }
+    for (size_t c = 0; c < 3; ++c) {
+      __m128i out = _mm_setzero_si128();
+      for (size_t j = 0; j < 3; ++j) {
+        out = _mm_or_si128(out, _mm_shuffle_epi8(in[j], _mm_load_si128(
+                                  reinterpret_cast<const __m128i*>(m.to_planar[c][j]))));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(planar + c * pixels + p), out);
+    }
+  }
+  interleaved_to_planar_range(interleaved, planar, pixels, 3, p, end);
+}
+#endif
+
+template<typename T>
+bool interleave_has_simd(size_t channels)
+{
+#ifdef INTERLEAVE_SSSE3
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  return ssse3 && channels == 3 && sizeof(T) == 1;
+#else
+  (void)channels;
+  return false;
+#endif
+}
+
+inline reduce_options interleave_schedule(size_t pixels, const interleave_options& opt)
+{
+  reduce_options ropt;
+  ropt.threads = std::max<size_t>(1, std::min(opt.threads, pixels / std::max<size_t>(1, opt.min_per_thread)));
+  return ropt;
+}
+
+// planar[c * pixels + p] -> interleaved[p * channels + c]
+template<typename T>
+void planar_to_interleaved(const T* planar, T* interleaved, size_t pixels, size_t channels,
+                           const interleave_options& opt = interleave_options())
+{
+  parallel_for(0, pixels, [&](size_t b, size_t e) {
+#ifdef INTERLEAVE_SSSE3
+      if (interleave_has_simd<T>(channels)) {
+        planar_to_interleaved_rgb8_ssse3(reinterpret_cast<const uint8_t*>(planar),
+                                         reinterpret_cast<uint8_t*>(interleaved), pixels, b, e);
+        return;
+      }
+#endif
+      planar_to_interleaved_range(planar, interleaved, pixels, channels, b, e);
+  }, interleave_schedule(pixels, opt));
+}
+
+// interleaved[p * channels + c] -> planar[c * pixels + p]
+template<typename T>
+void interleaved_to_planar(const T* interleaved, T* planar, size_t pixels, size_t channels,
+                           const interleave_options& opt = interleave_options())
+{
+  parallel_for(0, pixels, [&](size_t b, size_t e) {
+#ifdef INTERLEAVE_SSSE3
+      if (interleave_has_simd<T>(channels)) {
+        interleaved_to_planar_rgb8_ssse3(reinterpret_cast<const uint8_t*>(interleaved),
+                                         reinterpret_cast<uint8_t*>(planar), pixels, b, e);
+        return;
+      }
+#endif
+      interleaved_to_planar_range(interleaved, planar, pixels, channels, b, e);
+  }, interleave_schedule(pixels, opt));
+}
+
+#ifdef cimg_version
+// drop-in replacements of the drivers' initArray/convertImage for 2D
+// images: the pixels of img interleaved into array, and back
+template<typename T>
+void cimg_to_interleaved(const cimg_library::CImg<T>& img, T* array,
+                         const interleave_options& opt = interleave_options())
+{
+  planar_to_interleaved(img.data(), array, (size_t)img.width() * img.height() * img.depth(),
+                        img.spectrum(), opt);
+}
+
+template<typename T>
+void cimg_from_interleaved(const T* array, cimg_library::CImg<T>& img,
+                           const interleave_options& opt = interleave_options())
+{
+  interleaved_to_planar(array, img.data(), (size_t)img.width() * img.height() * img.depth(),
+                        img.spectrum(), opt);
+}
+#endif
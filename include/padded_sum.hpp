@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// One partial result per thread on its own cache line. Even if the
+// allocator does not honour the alignment (operator new before C++17),
+// slots are sizeof(padded_sum<T>) = 64 bytes apart, so two threads never
+// write the same line.
+template<typename T>
+struct alignas(64) padded_sum {
+    T value;
+};
+
+static_assert(sizeof(padded_sum<long double>) == 64, "padded_sum must fill one cache line");
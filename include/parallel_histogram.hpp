@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <parallel_reduce.hpp>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLEL_HISTOGRAM_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Parallel histogram of the values in [min_value, max_value] with the
+// semantics of CImg's get_histogram(nb_levels, min_value, max_value):
+// value v goes to bucket (v - min) * nb_levels / (max - min), computed in
+// double, max goes to the last bucket and values out of range are dropped.
+//
+// Every thread counts its block into a private histogram, so the hot loop
+// has no shared writes. The private histograms are merged in a binary
+// tree: in round r thread i (a multiple of 2r) waits for thread i + r and
+// adds its histogram to its own, so the merge takes log2(threads) steps
+// and runs while slower threads are still counting.
+//
+// Privatization costs threads * nb_levels counters to clear and merge.
+// When that is larger than the input block of a thread, or does not fit in
+// `private_bytes` per thread, all threads count into one histogram of
+// relaxed atomics instead: with many buckets two threads rarely hit the
+// same counter.
+//
+// Buckets of float, int and unsigned char values are computed 4 at a time
+// with AVX2 when the CPU supports it, with the same double arithmetic as
+// the scalar code. Off x86-64 every type takes the scalar loop.
+
+using histogram_count = uint64_t;
+
+struct histogram_options
+{
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t private_bytes = 1 << 20;   // largest private histogram per thread
+};
+
+// bucket of one value, nb_levels when it is out of range
+template<typename T>
+inline size_t histogram_bucket(T value, double vmin, double vmax, size_t nb_levels)
+{
+  if (!(value >= vmin && value <= vmax)) {
+    return nb_levels;
+  }
+  return value == vmax ? nb_levels - 1 : size_t((value - vmin) * nb_levels / (vmax - vmin));
+}
+
+#ifdef PARALLEL_HISTOGRAM_AVX2
+// 4 doubles converted from data[i..i+4)
+template<typename T>
+struct histogram_load;
+
+template<>
+struct histogram_load<float>
+{
+  __attribute__((target("avx2")))
+  static __m256d load(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+};
+
+template<>
+struct histogram_load<int>
+{
+  __attribute__((target("avx2")))
+  static __m256d load(const int* p)
+  {
+    return _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  }
+};
+
+template<>
+struct histogram_load<unsigned char>
+{
+  __attribute__((target("avx2")))
+  static __m256d load(const unsigned char* p)
+  {
+    int32_t four;
+    std::copy(p, p + 4, reinterpret_cast<unsigned char*>(&four));
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(four)));
+  }
+};
+
+// counts data[begin, end) into counts (nb_levels + 1 entries, the last
+// one collects the values out of range) with AVX2 bucket computation
+template<typename T, typename Counts>
+__attribute__((target("avx2")))
+void histogram_count_avx2(const T* data, size_t begin, size_t end, double vmin, double vmax,
+                          size_t nb_levels, Counts& counts)
+{
+  const __m256d lo = _mm256_set1_pd(vmin), hi = _mm256_set1_pd(vmax);
+  const __m256d scale = _mm256_set1_pd(double(nb_levels)), range = _mm256_set1_pd(vmax - vmin);
+  const __m256d last = _mm256_set1_pd(double(nb_levels - 1)), out = _mm256_set1_pd(double(nb_levels));
+  alignas(16) int32_t bucket[4];
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m256d v = histogram_load<T>::load(data + i);
+    __m256d b = _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(v, lo), scale), range);
+    // v == max goes to the last bucket, v out of [min, max] to `out`
+    __m256d in_range = _mm256_and_pd(_mm256_cmp_pd(v, lo, _CMP_GE_OQ), _mm256_cmp_pd(v, hi, _CMP_LE_OQ));
+    b = _mm256_blendv_pd(b, last, _mm256_cmp_pd(v, hi, _CMP_EQ_OQ));
+    b = _mm256_blendv_pd(out, b, in_range);
+    __m128i index = _mm256_cvttpd_epi32(b);
+    _mm_store_si128(reinterpret_cast<__m128i*>(bucket), index);
+    ++counts[bucket[0]];
+    ++counts[bucket[1]];
+    ++counts[bucket[2]];
+    ++counts[bucket[3]];
+  }
+  for (; i < end; ++i) {
+    ++counts[histogram_bucket(data[i], vmin, vmax, nb_levels)];
+  }
+}
+
+#endif
+
+template<typename T>
+struct histogram_has_simd
+{
+#ifdef PARALLEL_HISTOGRAM_AVX2
+  static constexpr bool value = std::is_same<T, float>::value || std::is_same<T, int>::value ||
+                                std::is_same<T, unsigned char>::value;
+#else
+  static constexpr bool value = false;
+#endif
+};
+
+#ifdef PARALLEL_HISTOGRAM_AVX2
+template<typename T, typename Counts>
+typename std::enable_if<histogram_has_simd<T>::value>::type
+histogram_count_range(const T* data, size_t begin, size_t end, double vmin, double vmax,
+                      size_t nb_levels, Counts& counts)
+{
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2 && nb_levels < (1u << 30)) {
+    histogram_count_avx2(data, begin, end, vmin, vmax, nb_levels, counts);
+    return;
+  }
+  for (size_t i = begin; i < end; ++i) {
+    ++counts[histogram_bucket(data[i], vmin, vmax, nb_levels)];
+  }
+}
+#endif
+
+template<typename T, typename Counts>
+typename std::enable_if<!histogram_has_simd<T>::value>::type
+histogram_count_range(const T* data, size_t begin, size_t end, double vmin, double vmax,
+                      size_t nb_levels, Counts& counts)
+{
+  for (size_t i = begin; i < end; ++i) {
+    ++counts[histogram_bucket(data[i], vmin, vmax, nb_levels)];
+  }
+}
+
+// counter incremented with a relaxed fetch_add, so ++counts[b] works on
+// the shared histogram too
+struct histogram_atomic_ref
+{
+  std::atomic<histogram_count>& c;
+  void operator++() { c.fetch_add(1, std::memory_order_relaxed); }
+};
+
+struct histogram_atomic_counts
+{
+  std::vector<std::atomic<histogram_count>>& v;
+  histogram_atomic_ref operator[](size_t i) { return histogram_atomic_ref{v[i]}; }
+};
+
+// true when the private histograms would cost more than the counting
+inline bool histogram_use_atomics(size_t n, size_t nb_levels, const histogram_options& opt)
+{
+  const size_t threads = std::max<size_t>(1, opt.threads);
+  return threads > 1 &&
+         (nb_levels * sizeof(histogram_count) > opt.private_bytes || nb_levels > n / threads);
+}
+
+template<typename T>
+std::vector<histogram_count> parallel_histogram(const T* data, size_t n, size_t nb_levels,
+                                                T min_value, T max_value,
+                                                const histogram_options& opt = histogram_options())
+{
+  if (nb_levels == 0 || n == 0) {
+    return std::vector<histogram_count>();
+  }
+  const double vmin = double(min_value < max_value ? min_value : max_value);
+  const double vmax = double(min_value < max_value ? max_value : min_value);
+  const size_t threads = std::max<size_t>(1, std::min(opt.threads, n));
+  const auto chunks = split_evenly(n, threads);
+
+  if (histogram_use_atomics(n, nb_levels, opt)) {
+    std::vector<std::atomic<histogram_count>> shared(nb_levels + 1);
+    for (auto& c : shared) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    run_workers(threads, [&](size_t id) {
+        auto be = get_chunk_begin_end(chunks, id);
+        histogram_atomic_counts counts{shared};
+        histogram_count_range(data, be.first, be.second, vmin, vmax, nb_levels, counts);
+    });
+    std::vector<histogram_count> result(nb_levels);
+    for (size_t b = 0; b < nb_levels; ++b) {
+      result[b] = shared[b].load(std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+  std::vector<std::vector<histogram_count>> local(threads);
+  std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[threads]);
+  for (size_t t = 0; t < threads; ++t) {
+    done[t] = false;
+  }
+  run_workers(threads, [&](size_t id) {
+      // allocated and cleared by its owner, so it lives in its cache
+      local[id].assign(nb_levels + 1, 0);
+      auto be = get_chunk_begin_end(chunks, id);
+      histogram_count_range(data, be.first, be.second, vmin, vmax, nb_levels, local[id]);
+
+      for (size_t r = 1; r < threads && id % (2 * r) == 0; r *= 2) {
+        const size_t other = id + r;
+        if (other >= threads) {
+          continue;
+        }
+        while (!done[other].load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+        for (size_t b = 0; b < nb_levels; ++b) {
+          local[id][b] += local[other][b];
+        }
+      }
+      done[id].store(true, std::memory_order_release);
+  });
+  local[0].resize(nb_levels);
+  return local[0];
+}
+
+template<typename Container>
+std::vector<histogram_count> parallel_histogram(const Container& values, size_t nb_levels,
+                                                typename Container::value_type min_value,
+                                                typename Container::value_type max_value,
+                                                const histogram_options& opt = histogram_options())
+{
+  return parallel_histogram(values.data(), values.size(), nb_levels, min_value, max_value, opt);
+}
+
+#ifdef cimg_version
+// drop-in replacement for img.get_histogram(nb_levels, min_value, max_value)
+template<typename T>
+cimg_library::CImg<typename cimg_library::CImg<T>::ulongT>
+parallel_get_histogram(const cimg_library::CImg<T>& img, unsigned int nb_levels,
+                       const T& min_value, const T& max_value,
+                       const histogram_options& opt = histogram_options())
+{
+  if (!nb_levels || img.is_empty()) {
+    return cimg_library::CImg<typename cimg_library::CImg<T>::ulongT>();
+  }
+  auto counts = parallel_histogram(img.data(), img.size(), nb_levels, min_value, max_value, opt);
+  cimg_library::CImg<typename cimg_library::CImg<T>::ulongT> res(nb_levels, 1, 1, 1, 0);
+  std::copy(counts.begin(), counts.end(), res.data());
+  return res;
+}
+#endif
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Partitioning of an iteration space [begin, end) among threads and
+// parallel reductions on top of it.
+//
+// Schedules:
+//  - block: one contiguous chunk per thread (split_evenly)
+//  - cyclic: chunks of `chunk` iterations dealt round robin
+//  - dynamic: chunks of `chunk` iterations taken from a shared counter
+//  - guided: like dynamic, but chunks start at remaining / (2 * threads)
+//    and shrink down to `chunk`
+//
+// With `deterministic` set, the space is cut in blocks of `grain`
+// iterations that do not depend on the number of threads. Every block is
+// reduced on its own and the block results are combined in a fixed tree,
+// so the result is bit-identical for any thread count and schedule.
+
+typedef struct {
+    size_t large_chunk;
+    size_t small_chunk;
+    size_t split_item;
+} chunk_info;
+
+// For a given number of iterations N and threads
+// the iterations are divided:
+// N % threads receive N / threads + 1 iterations
+// the rest receive N / threads
+constexpr chunk_info
+split_evenly(size_t N, size_t threads)
+{
+    return {N / threads + 1, N / threads, N % threads};
+}
+
+inline std::pair<size_t, size_t>
+get_chunk_begin_end(const chunk_info& ci, size_t index)
+{
+    size_t begin = 0, end = 0;
+    if (index < ci.split_item ) {
+        begin = index*ci.large_chunk;
+        end = begin + ci.large_chunk; // (index + 1) * ci.large_chunk
+    } else {
+        begin = ci.split_item*ci.large_chunk + (index - ci.split_item) * ci.small_chunk;
+        end = begin + ci.small_chunk;
+    }
+    return std::make_pair(begin, end);
+}
+
+enum class schedule { block, cyclic, dynamic, guided };
+
+struct reduce_options
+{
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  schedule policy = schedule::block;
+  size_t chunk = 1024;        // cyclic/dynamic chunk, guided minimum chunk
+  bool deterministic = false;
+  size_t grain = 4096;        // block size in deterministic mode
+};
+
+// hands out the chunks of [0, n) that belong to one worker
+class chunk_source
+{
+  size_t _n;
+  size_t _threads;
+  schedule _policy;
+  size_t _chunk;
+  std::atomic<size_t> _next;  // dynamic and guided
+
+  public:
+  chunk_source(size_t n, size_t threads, schedule policy, size_t chunk)
+    : _n(n), _threads(threads), _policy(policy), _chunk(std::max<size_t>(chunk, 1)), _next(0)
+  {}
+
+  // calls f(begin, end) for every chunk of worker `id`
+  template<typename F>
+  void for_each_chunk(size_t id, F f)
+  {
+    switch (_policy) {
+      case schedule::block: {
+        auto be = get_chunk_begin_end(split_evenly(_n, _threads), id);
+        if (be.first < be.second) {
+          f(be.first, be.second);
+        }
+        break;
+      }
+      case schedule::cyclic:
+        for (size_t b = id * _chunk; b < _n; b += _threads * _chunk) {
+          f(b, std::min(_n, b + _chunk));
+        }
+        break;
+      case schedule::dynamic:
+        for (size_t b = _next.fetch_add(_chunk); b < _n; b = _next.fetch_add(_chunk)) {
+          f(b, std::min(_n, b + _chunk));
+        }
+        break;
+      case schedule::guided: {
+        size_t b = _next.load();
+        while (b < _n) {
+          size_t size = std::max(_chunk, (_n - b) / (2 * _threads));
+          size_t e = std::min(_n, b + size);
+          if (_next.compare_exchange_weak(b, e)) {
+            f(b, e);
+            b = e;
+          }
+        }
+        break;
+      }
+    }
+  }
+};
+
+// runs worker(id) on `threads` threads, the calling thread being worker 0
+template<typename F>
+void run_workers(size_t threads, F worker)
+{
+  std::vector<std::thread> thread_vector;
+  for (size_t id = 1; id < threads; ++id) {
+    thread_vector.push_back(std::thread(worker, id));
+  }
+  worker(0);
+  for (auto& t : thread_vector) {
+    t.join();
+  }
+}
+
+// f(begin, end) on every chunk of [begin, end) following the schedule
+template<typename F>
+void parallel_for(size_t begin, size_t end, F f,
+                  const reduce_options& opt = reduce_options())
+{
+  const size_t n = end > begin ? end - begin : 0;
+  const size_t threads = std::max<size_t>(1, std::min(opt.threads, n));
+  chunk_source source(n, threads, opt.policy, opt.chunk);
+  run_workers(threads, [&](size_t id) {
+      source.for_each_chunk(id, [&](size_t b, size_t e) { f(begin + b, begin + e); });
+  });
+}
+
+// Reduce [begin, end) where range_fn(b, e) returns the reduction of the
+// subrange [b, e) and reduce(a, b) combines two partial results. identity
+// must be neutral for reduce.
+template<typename T, typename RangeFn, typename Reduce>
+T parallel_reduce_ranges(size_t begin, size_t end, T identity, RangeFn range_fn,
+                         Reduce reduce, const reduce_options& opt = reduce_options())
+{
+  const size_t n = end > begin ? end - begin : 0;
+
+  if (opt.deterministic) {
+    const size_t grain = std::max<size_t>(opt.grain, 1);
+    const size_t blocks = (n + grain - 1) / grain;
+    if (blocks == 0) {
+      return identity;
+    }
+    std::vector<T> partial(blocks, identity);
+    reduce_options block_opt = opt;
+    block_opt.chunk = std::max<size_t>(1, opt.chunk / grain);
+    parallel_for(0, blocks, [&](size_t kb, size_t ke) {
+        for (size_t k = kb; k < ke; ++k) {
+          const size_t b = begin + k * grain;
+          partial[k] = range_fn(b, std::min(end, b + grain));
+        }
+      }, block_opt);
+    // fixed pairwise tree over the block results
+    for (size_t size = blocks; size > 1; size = (size + 1) / 2) {
+      for (size_t i = 0; i < size / 2; ++i) {
+        partial[i] = reduce(partial[2 * i], partial[2 * i + 1]);
+      }
+      if (size % 2) {
+        partial[size / 2] = partial[size - 1];
+      }
+    }
+    return partial[0];
+  }
+
+  // one partial result per worker, each on its own cache line
+  struct alignas(64) slot { T value; };
+  const size_t threads = std::max<size_t>(1, std::min(opt.threads, n));
+  std::vector<slot> partial(threads, slot{identity});
+  chunk_source source(n, threads, opt.policy, opt.chunk);
+  run_workers(threads, [&](size_t id) {
+      T local = identity;
+      source.for_each_chunk(id, [&](size_t b, size_t e) {
+          local = reduce(local, range_fn(begin + b, begin + e));
+      });
+      partial[id].value = local;
+  });
+
+  T result = identity;
+  for (const auto& p : partial) {
+    result = reduce(result, p.value);
+  }
+  return result;
+}
+
+// Reduce map(i) for every index i in [begin, end)
+template<typename T, typename Map, typename Reduce>
+T parallel_reduce_index(size_t begin, size_t end, T identity, Map map,
+                        Reduce reduce, const reduce_options& opt = reduce_options())
+{
+  return parallel_reduce_ranges(begin, end, identity,
+      [&](size_t b, size_t e) {
+        T local = identity;
+        for (size_t i = b; i < e; ++i) {
+          local = reduce(local, map(i));
+        }
+        return local;
+      }, reduce, opt);
+}
+
+// Reduce transform(*it) over a random access range
+template<typename RandomIt, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(RandomIt first, RandomIt last, T identity, Reduce reduce,
+                            Transform transform, const reduce_options& opt = reduce_options())
+{
+  return parallel_reduce_index(0, static_cast<size_t>(std::distance(first, last)), identity,
+      [&](size_t i) { return transform(first[i]); }, reduce, opt);
+}
+
+// Reduce the elements of a random access range
+template<typename RandomIt, typename T, typename Reduce>
+T parallel_reduce(RandomIt first, RandomIt last, T identity, Reduce reduce,
+                  const reduce_options& opt = reduce_options())
+{
+  return parallel_transform_reduce(first, last, identity, reduce,
+      [](const typename std::iterator_traits<RandomIt>::value_type& v) { return v; }, opt);
+}
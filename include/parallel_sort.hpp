@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <parallel_reduce.hpp>
+
+// Parallel sorting for large arrays (problems.md exercise 6).
+//
+// Sample sort: the bucket boundaries (splitters) are picked from a sorted
+// random sample instead of dividing [min, max] evenly, so skewed data
+// still gives buckets of similar size. Each thread then
+//  1. finds the bucket of every element of its block and counts them,
+//  2. after a prefix sum of the counts (bucket major, thread minor) moves
+//     its elements straight to their final bucket in a scratch array,
+//  3. takes buckets from a shared counter, sorts them and moves them back.
+// There are several buckets per thread so that step 3 balances. Elements
+// equal to a repeated splitter are spread over all the buckets that can
+// only hold that value, so many duplicates do not end up in one bucket.
+//
+// LSD radix sort (integer keys): one pass per byte of the key. Every pass
+// counts the digits of each thread's block, prefix sums the counts in the
+// same order and scatters stably into the other buffer. Passes whose
+// digit is the same for every key are skipped.
+//
+// parallel_sort_by_key sorts keys and moves values along, as CImg's
+// sort(permutations) does.
+
+struct sort_options
+{
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t buckets_per_thread = 4;
+  size_t oversampling = 32;      // sample elements per bucket
+  size_t min_per_thread = 1 << 14;  // smaller inputs use fewer threads
+};
+
+inline size_t sort_threads(size_t n, const sort_options& opt)
+{
+  return std::max<size_t>(1, std::min(opt.threads, n / std::max<size_t>(1, opt.min_per_thread)));
+}
+
+// offsets[t * buckets + b]: where thread t writes its first element of
+// bucket b. counts has the same layout. Returns the start of every bucket
+// (buckets + 1 entries).
+inline std::vector<size_t> sort_prefix_sum(const std::vector<size_t>& counts, size_t threads,
+                                           size_t buckets, std::vector<size_t>& offsets)
+{
+  std::vector<size_t> bucket_begin(buckets + 1, 0);
+  offsets.assign(threads * buckets, 0);
+  size_t sum = 0;
+  for (size_t b = 0; b < buckets; ++b) {
+    bucket_begin[b] = sum;
+    for (size_t t = 0; t < threads; ++t) {
+      offsets[t * buckets + b] = sum;
+      sum += counts[t * buckets + b];
+    }
+  }
+  bucket_begin[buckets] = sum;
+  return bucket_begin;
+}
+
+template<typename RandomIt, typename Compare>
+void parallel_sample_sort(RandomIt first, RandomIt last, Compare comp,
+                          const sort_options& opt = sort_options())
+{
+  using T = typename std::iterator_traits<RandomIt>::value_type;
+  const size_t n = static_cast<size_t>(last - first);
+  const size_t threads = sort_threads(n, opt);
+  if (threads == 1) {
+    std::sort(first, last, comp);
+    return;
+  }
+  const size_t buckets = threads * std::max<size_t>(1, opt.buckets_per_thread);
+
+  // splitters from a sorted sample, fixed seed so runs are repeatable
+  const size_t oversampling = std::max<size_t>(1, opt.oversampling);
+  std::vector<T> sample;
+  std::mt19937_64 gen(12345);
+  std::uniform_int_distribution<size_t> pick(0, n - 1);
+  for (size_t i = 0; i < buckets * oversampling; ++i) {
+    sample.push_back(first[pick(gen)]);
+  }
+  std::sort(sample.begin(), sample.end(), comp);
+  std::vector<T> splitters;
+  for (size_t b = 1; b < buckets; ++b) {
+    splitters.push_back(sample[b * oversampling]);
+  }
+
+  // bucket b holds splitters[b - 1] <= v < splitters[b]
+  auto bucket_of = [&](const T& v, size_t i) -> size_t {
+    size_t b = std::upper_bound(splitters.begin(), splitters.end(), v, comp) - splitters.begin();
+    if (b > 0 && !comp(splitters[b - 1], v)) {
+      // v equals splitters[b - 1]; buckets lo + 1 .. b can only hold v
+      size_t lo = std::lower_bound(splitters.begin(), splitters.end(), v, comp) - splitters.begin();
+      b = lo + 1 + i % (b - lo);
+    }
+    return b;
+  };
+
+  const auto chunks = split_evenly(n, threads);
+  std::vector<uint32_t> bucket(n);
+  std::vector<size_t> counts(threads * buckets, 0);
+  run_workers(threads, [&](size_t id) {
+      auto be = get_chunk_begin_end(chunks, id);
+      size_t* count = &counts[id * buckets];
+      for (size_t i = be.first; i < be.second; ++i) {
+        bucket[i] = static_cast<uint32_t>(bucket_of(first[i], i));
+        ++count[bucket[i]];
+      }
+  });
+
+  std::vector<size_t> offsets;
+  auto bucket_begin = sort_prefix_sum(counts, threads, buckets, offsets);
+
+  std::vector<T> scratch(n);
+  run_workers(threads, [&](size_t id) {
+      auto be = get_chunk_begin_end(chunks, id);
+      size_t* offset = &offsets[id * buckets];
+      for (size_t i = be.first; i < be.second; ++i) {
+        scratch[offset[bucket[i]]++] = std::move(first[i]);
+      }
+  });
+
+  // largest buckets first, so a big one does not finish last
+  std::vector<size_t> order(buckets);
+  for (size_t b = 0; b < buckets; ++b) {
+    order[b] = b;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return bucket_begin[a + 1] - bucket_begin[a] > bucket_begin[b + 1] - bucket_begin[b];
+  });
+  std::atomic<size_t> next(0);
+  run_workers(threads, [&](size_t) {
+      for (size_t k = next++; k < buckets; k = next++) {
+        const size_t b = order[k];
+        auto begin = scratch.begin() + bucket_begin[b], end = scratch.begin() + bucket_begin[b + 1];
+        std::sort(begin, end, comp);
+        std::move(begin, end, first + bucket_begin[b]);
+      }
+  });
+}
+
+template<typename RandomIt>
+void parallel_sample_sort(RandomIt first, RandomIt last, const sort_options& opt = sort_options())
+{
+  parallel_sample_sort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>(), opt);
+}
+
+// unsigned image of an integer key with the same order
+template<typename K>
+typename std::make_unsigned<K>::type radix_bits(K key)
+{
+  using U = typename std::make_unsigned<K>::type;
+  U bits = static_cast<U>(key);
+  if (std::is_signed<K>::value) {
+    bits ^= U(1) << (std::numeric_limits<U>::digits - 1);
+  }
+  return bits;
+}
+
+// Sorts keys[0, n) and, when values is not null, moves values[0, n) along
+template<typename K, typename V>
+void parallel_radix_sort_by_key(K* keys, V* values, size_t n,
+                                const sort_options& opt = sort_options())
+{
+  static_assert(std::is_integral<K>::value, "radix sort needs integer keys");
+  const size_t threads = sort_threads(n, opt);
+  const size_t radix = 256;
+  const auto chunks = split_evenly(n, threads);
+
+  std::vector<K> key_scratch(n);
+  std::vector<V> value_scratch(values ? n : 0);
+  K *src_keys = keys, *dst_keys = key_scratch.data();
+  V *src_values = values, *dst_values = value_scratch.data();
+
+  std::vector<size_t> counts(threads * radix), offsets;
+  for (size_t shift = 0; shift < 8 * sizeof(K); shift += 8) {
+    auto digit = [shift](K key) { return size_t(radix_bits(key) >> shift) & 0xff; };
+
+    std::fill(counts.begin(), counts.end(), 0);
+    run_workers(threads, [&](size_t id) {
+        auto be = get_chunk_begin_end(chunks, id);
+        size_t* count = &counts[id * radix];
+        for (size_t i = be.first; i < be.second; ++i) {
+          ++count[digit(src_keys[i])];
+        }
+    });
+    auto bucket_begin = sort_prefix_sum(counts, threads, radix, offsets);
+    bool trivial = false;
+    for (size_t d = 0; d < radix; ++d) {
+      trivial = trivial || bucket_begin[d + 1] - bucket_begin[d] == n;
+    }
+    if (trivial) {
+      continue;
+    }
+
+    run_workers(threads, [&](size_t id) {
+        auto be = get_chunk_begin_end(chunks, id);
+        size_t* offset = &offsets[id * radix];
+        for (size_t i = be.first; i < be.second; ++i) {
+          size_t to = offset[digit(src_keys[i])]++;
+          dst_keys[to] = src_keys[i];
+          if (values) {
+            dst_values[to] = std::move(src_values[i]);
+          }
+        }
+    });
+    std::swap(src_keys, dst_keys);
+    std::swap(src_values, dst_values);
+  }
+
+  if (src_keys != keys) {
+    reduce_options copy_opt;
+    copy_opt.threads = threads;
+    parallel_for(0, n, [&](size_t b, size_t e) {
+        std::copy(src_keys + b, src_keys + e, keys + b);
+        if (values) {
+          std::move(src_values + b, src_values + e, values + b);
+        }
+    }, copy_opt);
+  }
+}
+
+template<typename K>
+void parallel_radix_sort(K* keys, size_t n, const sort_options& opt = sort_options())
+{
+  parallel_radix_sort_by_key(keys, static_cast<char*>(nullptr), n, opt);
+}
+
+// integer keys: radix sort
+template<typename K, typename V>
+typename std::enable_if<std::is_integral<K>::value>::type
+parallel_sort_by_key(K* keys, V* values, size_t n, const sort_options& opt = sort_options())
+{
+  parallel_radix_sort_by_key(keys, values, n, opt);
+}
+
+// other keys: sample sort of (key, value) pairs
+template<typename K, typename V>
+typename std::enable_if<!std::is_integral<K>::value>::type
+parallel_sort_by_key(K* keys, V* values, size_t n, const sort_options& opt = sort_options())
+{
+  std::vector<std::pair<K, V>> pairs(n);
+  reduce_options copy_opt;
+  copy_opt.threads = sort_threads(n, opt);
+  parallel_for(0, n, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; ++i) {
+        pairs[i] = std::make_pair(keys[i], std::move(values[i]));
+      }
+  }, copy_opt);
+  parallel_sample_sort(pairs.begin(), pairs.end(),
+      [](const std::pair<K, V>& a, const std::pair<K, V>& b) { return a.first < b.first; }, opt);
+  parallel_for(0, n, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; ++i) {
+        keys[i] = pairs[i].first;
+        values[i] = std::move(pairs[i].second);
+      }
+  }, copy_opt);
+}
+
+// integer values go through the radix sort
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value>::type
+parallel_sort(T* data, size_t n, const sort_options& opt = sort_options())
+{
+  parallel_radix_sort(data, n, opt);
+}
+
+template<typename T>
+typename std::enable_if<!std::is_integral<T>::value>::type
+parallel_sort(T* data, size_t n, const sort_options& opt = sort_options())
+{
+  parallel_sample_sort(data, data + n, opt);
+}
+
+#ifdef cimg_version
+// parallel versions of img.sort(is_increasing) and
+// img.sort(permutations, is_increasing) on all the pixel values
+template<typename T>
+cimg_library::CImg<T>& parallel_cimg_sort(cimg_library::CImg<T>& img, bool is_increasing = true,
+                                          const sort_options& opt = sort_options())
+{
+  parallel_sort(img.data(), img.size(), opt);
+  if (!is_increasing) {
+    std::reverse(img.data(), img.data() + img.size());
+  }
+  return img;
+}
+
+template<typename T, typename t>
+cimg_library::CImg<T>& parallel_cimg_sort(cimg_library::CImg<T>& img,
+                                          cimg_library::CImg<t>& permutations,
+                                          bool is_increasing = true,
+                                          const sort_options& opt = sort_options())
+{
+  permutations.assign(img.width(), img.height(), img.depth(), img.spectrum());
+  for (size_t off = 0; off < img.size(); ++off) {
+    permutations[off] = static_cast<t>(off);
+  }
+  parallel_sort_by_key(img.data(), permutations.data(), img.size(), opt);
+  if (!is_increasing) {
+    std::reverse(img.data(), img.data() + img.size());
+    std::reverse(permutations.data(), permutations.data() + permutations.size());
+  }
+  return img;
+}
+#endif
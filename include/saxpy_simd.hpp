@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SAXPY_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Vectorized z[i] = a * x[i] + y[i] on raw float arrays.
+//
+// Every kernel peels scalar iterations until z is aligned to the vector
+// width, runs the vector body and finishes the remainder with scalar
+// code. x and y are loaded unaligned, since their offset relative to z is
+// arbitrary. With `stream` set, z is written with non-temporal stores so
+// an output larger than the last level cache does not evict x and y.
+//
+// The AVX2 and AVX-512 kernels use fused multiply-add, so their results
+// may differ from the scalar loop in the last bit. Off x86-64 only the
+// scalar kernel exists.
+
+enum class simd_level { scalar, sse2, avx2, avx512 };
+
+inline std::string simd_name(simd_level level)
+{
+  switch (level) {
+    case simd_level::sse2: return "sse2";
+    case simd_level::avx2: return "avx2";
+    case simd_level::avx512: return "avx512";
+    default: return "scalar";
+  }
+}
+
+inline bool simd_supported(simd_level level)
+{
+#ifndef SAXPY_SIMD_X86
+  return level == simd_level::scalar;
+#else
+  __builtin_cpu_init();
+  switch (level) {
+    case simd_level::sse2: return __builtin_cpu_supports("sse2");
+    case simd_level::avx2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case simd_level::avx512: return __builtin_cpu_supports("avx512f");
+    default: return true;
+  }
+#endif
+}
+
+// every level the running CPU supports, widest last
+inline std::vector<simd_level> simd_levels()
+{
+  std::vector<simd_level> levels;
+  for (auto level : {simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::avx512}) {
+    if (simd_supported(level)) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+inline simd_level simd_best()
+{
+  return simd_levels().back();
+}
+
+// size of the last level cache in bytes, 0 when unknown
+inline size_t llc_size()
+{
+  long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size <= 0) {
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+#endif
+  return size > 0 ? size_t(size) : 0;
+}
+
+// non-temporal stores pay off once the output does not fit in the LLC
+inline bool saxpy_should_stream(size_t n)
+{
+  const size_t llc = llc_size();
+  return llc != 0 && n * sizeof(float) > llc;
+}
+
+inline void saxpy_scalar(float* z, float a, const float* x, const float* y, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    z[i] = a * x[i] + y[i];
+  }
+}
+
+// number of scalar iterations until z + i is aligned to `bytes`
+inline size_t saxpy_peel(const float* z, size_t n, size_t bytes)
+{
+  size_t misalignment = reinterpret_cast<uintptr_t>(z) % bytes;
+  size_t peel = misalignment ? (bytes - misalignment) / sizeof(float) : 0;
+  return peel < n ? peel : n;
+}
+
+#ifdef SAXPY_SIMD_X86
+__attribute__((target("sse2")))
+inline void saxpy_sse2(float* z, float a, const float* x, const float* y, size_t n, bool stream)
+{
+  size_t i = saxpy_peel(z, n, 16);
+  saxpy_scalar(z, a, x, y, i);
+  const __m128 va = _mm_set1_ps(a);
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)), _mm_loadu_ps(y + i));
+    if (stream) {
+      _mm_stream_ps(z + i, v);
+    } else {
+      _mm_store_ps(z + i, v);
+    }
+  }
+  if (stream) {
+    _mm_sfence();
+  }
+  saxpy_scalar(z + i, a, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+inline void saxpy_avx2(float* z, float a, const float* x, const float* y, size_t n, bool stream)
+{
+  size_t i = saxpy_peel(z, n, 32);
+  saxpy_scalar(z, a, x, y, i);
+  const __m256 va = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+    if (stream) {
+      _mm256_stream_ps(z + i, v);
+    } else {
+      _mm256_store_ps(z + i, v);
+    }
+  }
+  if (stream) {
+    _mm_sfence();
+  }
+  saxpy_scalar(z + i, a, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline void saxpy_avx512(float* z, float a, const float* x, const float* y, size_t n, bool stream)
+{
+  size_t i = saxpy_peel(z, n, 64);
+  saxpy_scalar(z, a, x, y, i);
+  const __m512 va = _mm512_set1_ps(a);
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+    if (stream) {
+      _mm512_stream_ps(z + i, v);
+    } else {
+      _mm512_store_ps(z + i, v);
+    }
+  }
+  if (stream) {
+    _mm_sfence();
+  }
+  saxpy_scalar(z + i, a, x + i, y + i, n - i);
+}
+#endif
+
+// the caller is responsible for picking a level the CPU supports
+inline void saxpy_simd(simd_level level, float* z, float a, const float* x, const float* y,
+                       size_t n, bool stream)
+{
+  switch (level) {
+#ifdef SAXPY_SIMD_X86
+    case simd_level::sse2: saxpy_sse2(z, a, x, y, n, stream); break;
+    case simd_level::avx2: saxpy_avx2(z, a, x, y, n, stream); break;
+    case simd_level::avx512: saxpy_avx512(z, a, x, y, n, stream); break;
+#endif
+    default: saxpy_scalar(z, a, x, y, n); break;
+  }
+  (void)stream;
+}